@@ -79,6 +79,7 @@ CalDevice::CalDevice(QString serial) :
 {
     loadThread = nullptr;
     transferActive = false;
+    interpolationDisabled = false;
     tmpDir = QStandardPaths::writableLocation(QStandardPaths::TempLocation);
 
     // Check device identification
@@ -113,6 +114,7 @@ CalDevice::CalDevice(QString serial) :
     connect(usb, &USBDevice::communicationFailure, this, &CalDevice::disconnected);
     connect(this, &CalDevice::updateCoefficientsDone, this, [=]() {
         transferActive = false;
+        restoreInterpolation();
     });
 
     // Check if this device was affected by the factory calibration problem
@@ -299,6 +301,7 @@ void CalDevice::loadCoefficientSets(QStringList names, QList<int> ports, bool fa
     }
 
     abortLoading = false;
+    disableInterpolation();
     transferActive = true;
     if(fast && Util::firmwareEqualOrHigher(firmware, "0.2.1")) {
         loadThread = new std::thread(&CalDevice::loadCoefficientSetsThreadFast, this, names, ports);
@@ -314,6 +317,23 @@ void CalDevice::abortCoefficientLoading()
         loadThread->join();
         loadThread = nullptr;
         transferActive = false;
+        restoreInterpolation();
+    }
+}
+
+void CalDevice::disableInterpolation()
+{
+    // older firmware does not interpolate and responds with an error
+    if(!interpolationDisabled && usb->Query(":COEFF:INTERP?") == "TRUE") {
+        interpolationDisabled = usb->Cmd(":COEFF:INTERP FALSE");
+    }
+}
+
+void CalDevice::restoreInterpolation()
+{
+    if(interpolationDisabled) {
+        usb->Cmd(":COEFF:INTERP TRUE");
+        interpolationDisabled = false;
     }
 }
 
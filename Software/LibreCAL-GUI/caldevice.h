@@ -118,8 +118,14 @@ private:
     QString tmpDir;
     int numPorts;
     std::thread *loadThread;
+    // The device interpolates coefficients for its target temperature. The stored
+    // coefficients are loaded while interpolation is disabled
+    void disableInterpolation();
+    void restoreInterpolation();
+
     bool abortLoading;
     bool transferActive;
+    bool interpolationDisabled;
 
     float firmware_major_minor;
 
@@ -0,0 +1,171 @@
+// Host simulation of the temperature acquisition
+//
+// Compares the previous acquisition (one ADC conversion per control period, averaged with an
+// exponential filter) with the DMA based oversampling (median of group means over the last PWM
+// period, either over the whole period or synchronised to the PWM and only over the time the heater is
+// off). The raw ADC signal contains white noise, interference synchronous to the heater PWM and
+// occasional outliers. Reported are the noise and the offset of the reading at a constant temperature
+// and the additional lag while the temperature is ramping.
+//
+// Build and run on the host (no Pico SDK required):
+//   g++ -std=gnu++17 -O2 -I../src adc_sim.cpp ../src/AdcFilter.cpp -o adc_sim
+//   ./adc_sim
+
+#include "AdcFilter.hpp"
+
+#include <cstdio>
+#include <cmath>
+#include <random>
+
+// same settings as in Heater.cpp
+static constexpr float ControllerPeriod = 0.05f;
+static constexpr uint32_t SampleRate = 20000;
+static constexpr uint16_t RingSize = 2048;
+static constexpr uint8_t Groups = 20;
+static constexpr uint16_t GroupSize = 50;
+static constexpr uint16_t SettleSamples = 20;
+static constexpr float PWMPeriod = 0.05f;
+
+static float adcToTemp(float adc) {
+	float NTC_resistance = adc / (4096 - adc) * 10000 - 100;
+	constexpr float NTC_nominal = 10000.0f;
+	constexpr float NTC_B = 4300.0f;
+	constexpr float T0 = 25.0f;
+	constexpr float Tzero = 273.15f;
+	return (T0 + Tzero) * NTC_B / ((T0 + Tzero) * logf(NTC_resistance / NTC_nominal) + NTC_B) - Tzero;
+}
+
+static float tempToAdc(float temp) {
+	// invert adcToTemp by bisection
+	float low = 1, high = 4095;
+	for(int i=0;i<40;i++) {
+		float mid = (low + high) / 2;
+		// the NTC is on the upper side of the divider, the ADC value falls with the temperature
+		if(adcToTemp(mid) > temp) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return (low + high) / 2;
+}
+
+struct Signal {
+	float noise; // white noise in LSB
+	float pwmInterference; // offset in LSB while the heater is on
+	float duty; // heater PWM duty cycle
+	float outlierRate; // probability of a single sample being an outlier
+};
+
+struct Result {
+	float noise; // standard deviation of the reading in °C
+	float offset; // mean error of the reading in °C
+};
+
+struct Filter {
+	enum class Type {
+		EMA,
+		MedianOfMeans,
+		OffPhase,
+	};
+	const char *name;
+	Type type;
+};
+
+static Result run(const Filter &f, const Signal &s, float slope) {
+	std::mt19937 gen(1);
+	std::normal_distribution<float> white(0.0f, s.noise);
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+	static uint16_t ring[RingSize];
+	uint16_t index = 0;
+	float ema = 0;
+	bool first = true;
+
+	constexpr float Duration = 120.0f;
+	constexpr float Settle = 20.0f;
+	constexpr float Start = 35.0f;
+	const uint32_t samplesPerPeriod = ControllerPeriod * SampleRate;
+	double sum = 0, sum2 = 0;
+	uint32_t n = 0;
+	uint32_t sample = 0;
+	for(float t=0;t<Duration;t+=ControllerPeriod) {
+		// acquire one control period of samples (aligned to the PWM period)
+		uint16_t start = index;
+		for(uint32_t i=0;i<samplesPerPeriod;i++, sample++) {
+			float time = (float) sample / SampleRate;
+			float value = tempToAdc(Start + slope * time) + white(gen);
+			if(fmodf(time, PWMPeriod) < s.duty * PWMPeriod) {
+				value += s.pwmInterference;
+			}
+			if(uniform(gen) < s.outlierRate) {
+				value += uniform(gen) < 0.5f ? 500 : -500;
+			}
+			value = roundf(value);
+			value = value < 0 ? 0 : (value > 4095 ? 4095 : value);
+			ring[index] = value;
+			index = (index + 1) % RingSize;
+		}
+		float reading;
+		if(f.type == Filter::Type::MedianOfMeans) {
+			reading = AdcFilter::MedianOfMeans(ring, RingSize, index, Groups, GroupSize);
+		} else if(f.type == Filter::Type::OffPhase) {
+			uint16_t samples = (index + RingSize - start) % RingSize;
+			uint16_t onSamples = s.duty > 0 ? ceilf(s.duty * samples) + SettleSamples : 0;
+			reading = AdcFilter::OffPhaseMedianOfMeans(ring, RingSize, index, samples, onSamples, Groups);
+		} else {
+			// the previous firmware took a single conversion per control period
+			float single = ring[(index + RingSize - 1) % RingSize];
+			if(first) {
+				ema = single;
+				first = false;
+			}
+			ema = single * 0.05f + ema * 0.95f;
+			reading = ema;
+		}
+		if(t >= Settle) {
+			float time = (float) sample / SampleRate;
+			float error = adcToTemp(reading) - (Start + slope * time);
+			sum += error;
+			sum2 += error * error;
+			n++;
+		}
+	}
+	Result r;
+	r.offset = sum / n;
+	r.noise = sqrt(sum2 / n - r.offset * r.offset);
+	return r;
+}
+
+int main() {
+	const Filter filters[] = {
+		{"EMA of single conversions", Filter::Type::EMA},
+		{"Median of means", Filter::Type::MedianOfMeans},
+		{"Median of means, off phase", Filter::Type::OffPhase},
+	};
+	const Signal signals[] = {
+		{2.0f, 0.0f, 0.5f, 0.0f},
+		{2.0f, 4.0f, 0.3f, 0.0f},
+		{2.0f, 4.0f, 0.3f, 0.001f},
+		{2.0f, 4.0f, 0.95f, 0.0f},
+	};
+	const char *signalNames[] = {
+		"white noise",
+		"+PWM interference",
+		"+outliers",
+		"PWM at 95% duty",
+	};
+	constexpr float Slope = 0.05f; // °C/s, typical when approaching the target
+
+	printf("%-28s %-20s %12s %12s %10s\n", "Filter", "Signal", "Noise [mK]", "Offset [mK]", "Lag [ms]");
+	for(auto &f : filters) {
+		for(unsigned i=0;i<sizeof(signals)/sizeof(signals[0]);i++) {
+			auto constant = run(f, signals[i], 0.0f);
+			auto ramp = run(f, signals[i], Slope);
+			float lag = (constant.offset - ramp.offset) / Slope;
+			printf("%-28s %-20s %12.2f %12.2f %10.0f\n", f.name, signalNames[i], constant.noise * 1000,
+					constant.offset * 1000, lag * 1000);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+
+# Compares the Siglent eCal data generated by the firmware (siglent_sim) with
+# the output of Scripts/convert_siglent.py for a synthetic coefficient set.
+#
+# The files can not be identical: the firmware stores the CSV uncompressed and
+# writes ten significant digits instead of numpy's 19. Compared are the
+# content of the CSV (numerically) and the fields of info.dat, and the hash and
+# size in info.dat are checked against the generated zip.
+#
+# Usage (after building siglent_sim, see siglent_sim.cpp):
+#   python3 compare_siglent.py ./siglent_sim
+
+import hashlib
+import io
+import math
+import random
+import subprocess
+import sys
+import tempfile
+import zipfile
+from pathlib import Path
+
+POINTS = 1001
+
+if len(sys.argv) != 2:
+    print(f"usage: {sys.argv[0]} <path to siglent_sim>")
+    sys.exit(1)
+sim = Path(sys.argv[1]).resolve()
+converter = Path(__file__).resolve().parent.parent.parent / "Scripts" / "convert_siglent.py"
+
+random.seed(1)
+
+def value():
+    # spread over many decades, with some exact zeros
+    if random.random() < 0.02:
+        return 0.0
+    return random.choice([-1, 1]) * random.uniform(0.1, 1) * 10 ** random.randint(-12, 0)
+
+def write_coefficients(path, ports, points):
+    # ten significant digits, the lines must fit the line buffer of the firmware (200 characters)
+    lines = ["! created by compare_siglent.py", "# GHz S RI R 50.0"]
+    for i in range(points):
+        freq = 0.001 + i * 5.999 / (POINTS - 1)
+        lines.append(" ".join([repr(freq)] + [f"{value():.9e}" for _ in range(ports * ports * 2)]))
+    path.write_text("\r\n".join(lines) + "\r\n")
+
+def parse_info(data):
+    text = data[144:].rstrip(b"\x00").decode()
+    return data[:144], dict(line.split(":", 1) for line in text.strip().split("\n"))
+
+def fail(msg):
+    print("FAIL: " + msg)
+    sys.exit(1)
+
+with tempfile.TemporaryDirectory() as tmp:
+    tmp = Path(tmp)
+    coeffs = tmp / "LIBRECAL_R"
+    coeffs.mkdir()
+    # as written by createInfoFile() in main.cpp
+    (coeffs / "info.txt").write_bytes(b"Serial: 0123456789ABCDEF\r\nFirmware: 0.3.0\r\nNumber of populated ports: 4")
+    for port in "1234":
+        for standard in ["OPEN", "SHORT", "LOAD"]:
+            write_coefficients(coeffs / f"P{port}_{standard}.s1p", 1, POINTS)
+    for through in ["12", "13", "14", "23", "24"]:
+        write_coefficients(coeffs / f"P{through}_THROUGH.s2p", 2, POINTS)
+    # some early LibreCALs have a truncated P34_THROUGH.s2p
+    write_coefficients(coeffs / "P34_THROUGH.s2p", 2, POINTS - 10)
+
+    for name in ["python", "firmware"]:
+        (tmp / name).mkdir()
+    subprocess.run([sys.executable, converter, coeffs, tmp / "python"], check=True, stdout=subprocess.DEVNULL)
+    subprocess.run([sim, coeffs, tmp / "firmware"], check=True)
+
+    ref_zip = (tmp / "python/siglent/data0.zip").read_bytes()
+    ref_header, ref_info = parse_info((tmp / "python/siglent/info.dat").read_bytes())
+    fw_zip = (tmp / "firmware/siglent/data0.zip").read_bytes()
+    fw_dat = (tmp / "firmware/siglent/info.dat").read_bytes()
+    fw_header, fw_info = parse_info(fw_dat)
+
+    with zipfile.ZipFile(io.BytesIO(fw_zip)) as zf:
+        if zf.testzip() is not None:
+            fail("CRC error in the generated zip")
+        if zf.namelist() != ["Factory.csv"] or zf.getinfo("Factory.csv").compress_type != zipfile.ZIP_STORED:
+            fail("unexpected zip content")
+        fw_csv = zf.read("Factory.csv").decode().split("\n")
+    with zipfile.ZipFile(io.BytesIO(ref_zip)) as zf:
+        ref_csv = zf.read("Factory.csv").decode().split("\n")
+
+    if len(fw_csv) != len(ref_csv):
+        fail(f"{len(fw_csv)} lines generated, expected {len(ref_csv)}")
+    rows = 0
+    for fw_line, ref_line in zip(fw_csv, ref_csv):
+        if ref_line.startswith("!") or ref_line.startswith("#") or not ref_line:
+            if fw_line != ref_line:
+                fail(f"'{fw_line}' instead of '{ref_line}'")
+            continue
+        fw_values = [float(x) for x in fw_line.split(",")]
+        ref_values = [float(x) for x in ref_line.split(",")]
+        if len(fw_values) != len(ref_values):
+            fail(f"{len(fw_values)} columns generated, expected {len(ref_values)}")
+        for a, b in zip(fw_values, ref_values):
+            if not math.isclose(a, b, rel_tol=6e-10, abs_tol=0):
+                fail(f"value {a!r} instead of {b!r} in row {rows}")
+        rows += 1
+
+    if len(fw_dat) != 1024 or fw_header != ref_header:
+        fail("binary header of info.dat differs")
+    md5 = hashlib.md5(fw_zip).hexdigest()
+    expected = dict(ref_info, Desc=md5, Data=f"0,{len(fw_zip)},{md5}", Date=fw_info.get("Date"))
+    if fw_info != expected:
+        fail(f"info.dat contains {fw_info}, expected {expected}")
+
+    print(f"OK: {rows} points, zip {len(fw_zip)} bytes (converter: {len(ref_zip)} bytes deflated)")
@@ -0,0 +1,12 @@
+// Host replacement of FileSystem.cpp for the simulations
+//
+// The simulations are single threaded, the lock does nothing. Link it instead of
+// ../src/FileSystem.cpp when building modules that access files.
+
+#include "FileSystem.hpp"
+
+FileSystem::Lock::Lock() {
+}
+
+FileSystem::Lock::~Lock() {
+}
@@ -0,0 +1,337 @@
+// Host simulation of the heater control loop
+//
+// Simulates the thermal behavior of the board and reports the time until the temperature is
+// reported as stable, comparing the model based controller (HeaterControl) with the previous
+// PI controller and its fixed 60s stability window.
+//
+// The time-to-stable prediction is evaluated at several points in time of the warm-up against the time
+// the simulation actually took, with the thermal model matching the plant and with a model that is off
+// by 10% (as the auto-tuning might be).
+//
+// It also runs the model identification of the heater auto-tuning against plants with different
+// parameters and reports the identified values.
+//
+// The temperature is acquired as in the firmware: the ADC samples the NTC during every PWM period (with
+// white noise and interference while the heater is on) and the reading is the median of means over the
+// off phase (AdcFilter). The previous PI controller uses the previous acquisition, a single conversion per
+// control period averaged with an exponential filter.
+//
+// Build and run on the host (no Pico SDK required):
+//   g++ -std=gnu++17 -O2 -I../src heater_sim.cpp ../src/HeaterControl.cpp ../src/AdcFilter.cpp -o heater_sim
+//   ./heater_sim
+
+#include "HeaterControl.hpp"
+#include "AdcFilter.hpp"
+
+#include <cstdio>
+#include <cmath>
+#include <random>
+
+// Thermal plant: the board (heated directly) and the NTC, which follows the board with a delay
+struct Plant {
+	float resistance; // in °C/W
+	float capacity; // in J/°C
+	float sensorDelay; // time constant of the NTC in s
+	float ambient; // in °C
+
+	float board;
+	float sensor;
+
+	void Reset(float temp) {
+		board = temp;
+		sensor = temp;
+	}
+	void Step(float power, float dt) {
+		board += (power - (board - ambient) / resistance) / capacity * dt;
+		sensor += (board - sensor) / sensorDelay * dt;
+	}
+};
+
+static float adcToTemp(float adc) {
+	float NTC_resistance = adc / (4096 - adc) * 10000 - 100;
+	constexpr float NTC_nominal = 10000.0f;
+	constexpr float NTC_B = 4300.0f;
+	constexpr float T0 = 25.0f;
+	constexpr float Tzero = 273.15f;
+	return (T0 + Tzero) * NTC_B / ((T0 + Tzero) * logf(NTC_resistance / NTC_nominal) + NTC_B) - Tzero;
+}
+
+static float tempToAdc(float temp) {
+	// invert adcToTemp by bisection
+	float low = 1, high = 4095;
+	for(int i=0;i<40;i++) {
+		float mid = (low + high) / 2;
+		// the NTC is on the upper side of the divider, the ADC value falls with the temperature
+		if(adcToTemp(mid) > temp) {
+			low = mid;
+		} else {
+			high = mid;
+		}
+	}
+	return (low + high) / 2;
+}
+
+// Temperature acquisition, one reading per PWM period (same settings as in Heater.cpp)
+class Acquisition {
+public:
+	Acquisition(bool legacy) : legacy(legacy), gen(1), white(0.0f, Noise) {}
+	// samples one PWM period with the sensor at the given temperature and the heater at the given power
+	float Read(float sensor, float power) {
+		float duty = power / HeaterControl::DefaultParameters.maxPower;
+		duty = duty < 0 ? 0 : (duty > 1 ? 1 : duty);
+		float adc = tempToAdc(sensor);
+		uint16_t start = index;
+		for(uint16_t i=0;i<PeriodSamples;i++) {
+			float value = adc + white(gen);
+			if(i < duty * PeriodSamples) {
+				value += PWMInterference;
+			}
+			value = roundf(value);
+			ring[index] = value < 0 ? 0 : (value > 4095 ? 4095 : value);
+			index = (index + 1) % RingSize;
+		}
+		if(legacy) {
+			// single conversion at the time of the control loop
+			float single = adcToTemp(ring[(index + RingSize - 1) % RingSize]);
+			if(first) {
+				ema = single;
+				first = false;
+			}
+			ema = single * 0.05f + ema * 0.95f;
+			return ema;
+		}
+		uint16_t samples = (index + RingSize - start) % RingSize;
+		uint16_t onSamples = duty > 0 ? ceilf(duty * samples) + SettleSamples : 0;
+		return adcToTemp(AdcFilter::OffPhaseMedianOfMeans(ring, RingSize, index, samples, onSamples, Groups));
+	}
+private:
+	static constexpr uint16_t PeriodSamples = 1000;
+	static constexpr uint16_t RingSize = 2048;
+	static constexpr uint8_t Groups = 20;
+	static constexpr uint16_t SettleSamples = 20;
+	static constexpr float Noise = 2.0f; // white noise in LSB
+	static constexpr float PWMInterference = 4.0f; // offset in LSB while the heater is on
+
+	bool legacy;
+	std::mt19937 gen;
+	std::normal_distribution<float> white;
+	uint16_t ring[RingSize] = {};
+	uint16_t index = 0;
+	float ema = 0;
+	bool first = true;
+};
+
+// The PI controller with the fixed stability window as it was used before
+class LegacyController {
+public:
+	float Update(float temp, float target, float dt) {
+		constexpr float P = 0.4f;
+		constexpr float I = 0.05f;
+		constexpr float I_limit = 2.0f;
+		float deviation = target - temp;
+		if(power < maxPower || power > 0) {
+			integral += deviation * I * dt;
+		}
+		if(integral > I_limit) {
+			integral = I_limit;
+		} else if(integral < -I_limit) {
+			integral = -I_limit;
+		}
+		power = deviation * P + integral;
+		if(power > maxPower) {
+			power = maxPower;
+		} else if(power < 0) {
+			power = 0;
+		}
+		return power;
+	}
+	bool Stable(float temp, float target, float time) {
+		if(fabsf(temp - target) > 0.25f) {
+			lastUnstable = time;
+			stable = false;
+		} else if(time - lastUnstable > 60.0f) {
+			stable = true;
+		}
+		return stable;
+	}
+private:
+	static constexpr float maxPower = 1.9f;
+	float integral = 0;
+	float power = 0;
+	float lastUnstable = 0;
+	bool stable = false;
+};
+
+struct Result {
+	float timeToStable; // in s, negative if never stable
+	float overshoot; // in °C
+	bool lostStability; // stable was reported and revoked again
+};
+
+template<bool legacy>
+static Result simulate(Plant plant, float target, float duration) {
+	constexpr float dt = 0.05f; // controller period
+	Acquisition acquisition(legacy);
+
+	HeaterControl::Controller controller;
+	HeaterControl::StabilityDetector detector;
+	LegacyController legacyController;
+
+	plant.Reset(plant.ambient);
+	float filtered = acquisition.Read(plant.sensor, 0);
+	controller.Reset(filtered, target);
+
+	Result r = {-1.0f, 0.0f, false};
+	float power = 0;
+	for(float t=0;t<duration;t+=dt) {
+		filtered = acquisition.Read(plant.sensor, power);
+		bool stable;
+		if(legacy) {
+			power = legacyController.Update(filtered, target, dt);
+			stable = legacyController.Stable(filtered, target, t);
+		} else {
+			power = controller.Update(filtered, target, dt);
+			stable = detector.Update(filtered, target, dt);
+		}
+		if(stable && r.timeToStable < 0) {
+			r.timeToStable = t;
+		} else if(!stable && r.timeToStable >= 0) {
+			r.lostStability = true;
+		}
+		if(plant.board - target > r.overshoot) {
+			r.overshoot = plant.board - target;
+		}
+		plant.Step(power, dt);
+	}
+	return r;
+}
+
+// modelError: relative error of the thermal resistance in the model, the capacity is off in the other direction
+static void predict(Plant plant, float target, float modelError) {
+	constexpr float dt = 0.05f;
+	constexpr float checkpoints[] = {0.0f, 60.0f, 120.0f, 180.0f};
+	constexpr uint8_t numCheckpoints = sizeof(checkpoints) / sizeof(checkpoints[0]);
+	Acquisition acquisition(false);
+
+	// the thermal model of the board is known (after the auto-tuning)
+	auto parameters = HeaterControl::DefaultParameters;
+	parameters.thermalResistance = plant.resistance * (1.0f + modelError);
+	parameters.thermalCapacity = plant.capacity * (1.0f - modelError);
+	HeaterControl::Controller controller(parameters);
+	HeaterControl::StabilityDetector detector;
+
+	plant.Reset(plant.ambient);
+	float filtered = acquisition.Read(plant.sensor, 0);
+	controller.Reset(filtered, target);
+	// as in the firmware, the slope is taken from the readings one second apart
+	float lastSecond = filtered;
+	float slope = 0;
+	uint16_t steps = 0;
+
+	float predicted[numCheckpoints];
+	uint8_t next = 0;
+	float stableTime = -1;
+	float power = 0;
+	for(float t=0;t<1800.0f && stableTime < 0;t+=dt) {
+		filtered = acquisition.Read(plant.sensor, power);
+		power = controller.Update(filtered, target, dt);
+		if(detector.Update(filtered, target, dt)) {
+			stableTime = t;
+		}
+		if(++steps >= 1.0f / dt) {
+			steps = 0;
+			slope = filtered - lastSecond;
+			lastSecond = filtered;
+		}
+		if(next < numCheckpoints && t >= checkpoints[next]) {
+			predicted[next++] = HeaterControl::PredictTimeToStable(controller, detector, filtered, slope, target);
+		}
+		plant.Step(power, dt);
+	}
+	printf("%9.1f%9.1f%8.1f |", plant.resistance, plant.capacity, plant.ambient);
+	for(uint8_t i=0;i<numCheckpoints;i++) {
+		if(i < next && stableTime > checkpoints[i]) {
+			printf("%9.0f/%-5.0f", predicted[i], stableTime - checkpoints[i]);
+		} else {
+			printf("%15s", "-");
+		}
+	}
+	printf("\n");
+}
+
+static void identify(Plant plant) {
+	constexpr float dt = 0.05f;
+	Acquisition acquisition(false);
+
+	plant.Reset(plant.ambient);
+	float filtered = acquisition.Read(plant.sensor, 0);
+	HeaterControl::Identification id;
+	id.Start(filtered, HeaterControl::DefaultParameters.maxPower);
+	float t = 0;
+	float power = 0;
+	while(id.IsRunning()) {
+		filtered = acquisition.Read(plant.sensor, power);
+		power = id.Update(filtered, dt);
+		plant.Step(power, dt);
+		t += dt;
+	}
+	if(id.GetState() == HeaterControl::Identification::State::Done) {
+		printf("%9.1f%9.1f%8.1f |%19.1f%9.1f%8.1f%13.0f\n", plant.resistance, plant.capacity, plant.ambient,
+				id.GetResistance(), id.GetCapacity(), id.GetAmbient(), t);
+	} else {
+		printf("%9.1f%9.1f%8.1f |             FAILED%30.0f\n", plant.resistance, plant.capacity, plant.ambient, t);
+	}
+}
+
+int main() {
+	constexpr float target = 35.0f;
+	constexpr float duration = 1800.0f;
+	const float resistances[] = {25.0f, 30.0f, 40.0f};
+	const float capacities[] = {12.0f, 20.0f, 35.0f};
+	const float ambients[] = {15.0f, 22.0f, 28.0f};
+
+	printf("   R[C/W]   C[J/C]   Ta[C] |  legacy: stable[s] overshoot[C] |  model: stable[s] overshoot[C]\n");
+	for(auto R : resistances) {
+		for(auto C : capacities) {
+			for(auto Ta : ambients) {
+				Plant plant = {R, C, 5.0f, Ta};
+				auto l = simulate<true>(plant, target, duration);
+				auto m = simulate<false>(plant, target, duration);
+				printf("%9.1f%9.1f%8.1f |%18.1f%s%13.2f |%17.1f%s%13.2f\n", R, C, Ta,
+						l.timeToStable, l.lostStability ? "*" : " ", l.overshoot,
+						m.timeToStable, m.lostStability ? "*" : " ", m.overshoot);
+			}
+		}
+	}
+	printf("(* stable was reported and revoked again, -1: never stable)\n");
+
+	for(auto modelError : {0.0f, 0.1f}) {
+		printf("\nTime-to-stable prediction, model R %+.0f%%, C %+.0f%% (predicted/actual remaining time in s at t = 0, 60, 120, 180s):\n",
+				modelError * 100, 0.0f - modelError * 100);
+		printf("   R[C/W]   C[J/C]   Ta[C] |");
+		for(auto t : {0, 60, 120, 180}) {
+			printf("       t=%-4d  ", t);
+		}
+		printf("\n");
+		for(auto R : resistances) {
+			for(auto C : capacities) {
+				for(auto Ta : ambients) {
+					Plant plant = {R, C, 5.0f, Ta};
+					predict(plant, target, modelError);
+				}
+			}
+		}
+	}
+
+	printf("\nModel identification (auto-tuning):\n");
+	printf("   R[C/W]   C[J/C]   Ta[C] | identified: R[C/W]   C[J/C]   Ta[C]  duration[s]\n");
+	for(auto R : resistances) {
+		for(auto C : capacities) {
+			for(auto Ta : ambients) {
+				Plant plant = {R, C, 5.0f, Ta};
+				identify(plant);
+			}
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+// Host replacement of Scratch.cpp for the simulations
+//
+// Same arena as the firmware, without the mutex (the simulations are single threaded). Link it
+// instead of ../src/Scratch.cpp when building modules that check out buffers.
+
+#include "Scratch.hpp"
+
+#include <cstdio>
+
+static constexpr uint32_t Alignment = 8;
+
+static uint8_t arena[Scratch::Size] __attribute__((aligned(Alignment)));
+static uint32_t used;
+static uint32_t maxUsed;
+
+void *Scratch::Checkout(uint32_t size) {
+	size = (size + Alignment - 1) & ~(Alignment - 1);
+	if(size > Size - used) {
+		printf("Scratch: unable to check out %u bytes, %u in use\n", size, used);
+		return nullptr;
+	}
+	void *p = &arena[used];
+	used += size;
+	if(used > maxUsed) {
+		maxUsed = used;
+	}
+	return p;
+}
+
+void Scratch::Release(void *p) {
+	used = (uint8_t*) p - arena;
+}
+
+uint32_t Scratch::GetMaxUsage() {
+	return maxUsed;
+}
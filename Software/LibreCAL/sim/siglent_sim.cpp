@@ -0,0 +1,223 @@
+// Host simulation of the Siglent eCal data generation
+//
+// Stores a coefficient set from a directory on the host (info.txt and the OPEN/SHORT/LOAD/THROUGH
+// touchstone files, the layout of the LIBRECAL_R drive) on a RAM disk through the firmware's
+// Touchstone module, selects it as the source of the Siglent data and writes the generated info.dat
+// and data0.zip into <output>/siglent. compare_siglent.py checks the result against convert_siglent.py.
+//
+// Build and run on the host (no Pico SDK required):
+//   gcc -c -O2 -I../src/fatfs ../src/fatfs/ff.c ../src/fatfs/ffunicode.c
+//   g++ -std=gnu++17 -O2 -I../src -I../src/fatfs siglent_sim.cpp scratch_sim.cpp filesystem_sim.cpp ../src/Siglent.cpp ../src/Touchstone.cpp ff.o ffunicode.o -o siglent_sim
+//   ./siglent_sim <input directory> <output directory>
+
+#include "Siglent.hpp"
+#include "Touchstone.hpp"
+#include "ff.h"
+#include "diskio.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+
+// RAM disk with the sector size of the flash, large enough for a set with a few thousand points
+static constexpr uint32_t SectorSize = FF_MAX_SS;
+static constexpr uint32_t Sectors = 2048;
+static std::vector<uint8_t> disks[FF_VOLUMES];
+
+extern "C" DSTATUS disk_status(BYTE pdrv) {
+	return 0;
+}
+
+extern "C" DSTATUS disk_initialize(BYTE pdrv) {
+	disks[pdrv].resize(SectorSize * Sectors);
+	return 0;
+}
+
+extern "C" DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
+	memcpy(buff, &disks[pdrv][sector * SectorSize], count * SectorSize);
+	return RES_OK;
+}
+
+extern "C" DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count) {
+	memcpy(&disks[pdrv][sector * SectorSize], buff, count * SectorSize);
+	return RES_OK;
+}
+
+extern "C" DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+	switch(cmd) {
+	case GET_SECTOR_COUNT: *(LBA_t*) buff = Sectors; break;
+	case GET_SECTOR_SIZE: *(WORD*) buff = SectorSize; break;
+	case GET_BLOCK_SIZE: *(DWORD*) buff = 1; break;
+	}
+	return RES_OK;
+}
+
+extern "C" DWORD get_fattime(void) {
+	time_t now = time(nullptr);
+	auto t = gmtime(&now);
+	return (DWORD) (t->tm_year - 80) << 25 | (DWORD) (t->tm_mon + 1) << 21 | (DWORD) t->tm_mday << 16
+			| (DWORD) t->tm_hour << 11 | (DWORD) t->tm_min << 5 | (DWORD) t->tm_sec >> 1;
+}
+
+static std::string serial;
+extern "C" const char* getSerial() {
+	return serial.c_str();
+}
+
+// Referenced by Touchstone.cpp, implemented in main.cpp
+FATFS fs0, fs1;
+bool createInfoFile() {
+	return true;
+}
+
+static bool readHostFile(const std::string &path, std::string &content) {
+	auto f = fopen(path.c_str(), "rb");
+	if(!f) {
+		return false;
+	}
+	char buf[4096];
+	size_t n;
+	while((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		content.append(buf, n);
+	}
+	fclose(f);
+	return true;
+}
+
+static bool writeHostFile(const std::string &path, const uint8_t *data, size_t len) {
+	auto f = fopen(path.c_str(), "wb");
+	if(!f) {
+		return false;
+	}
+	bool success = fwrite(data, 1, len, f) == len;
+	return fclose(f) == 0 && success;
+}
+
+static bool generate(Siglent::File file, const std::string &path) {
+	auto start = std::chrono::steady_clock::now();
+	int32_t size = Siglent::Open(file);
+	if(size < 0) {
+		return false;
+	}
+	std::vector<uint8_t> data(size);
+	// read in the chunk size of the USB worker
+	uint32_t cnt = 0, n;
+	while((n = Siglent::Read(&data[cnt], size - cnt < 2048 ? size - cnt : 2048)) > 0) {
+		cnt += n;
+	}
+	uint8_t extra;
+	if(cnt != (uint32_t) size || Siglent::Read(&extra, 1) != 0) {
+		printf("%s: read %u bytes, announced %d\n", path.c_str(), cnt, size);
+		return false;
+	}
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	printf("%s: %d bytes in %lldms\n", path.c_str(), size, (long long) ms);
+	return writeHostFile(path, data.data(), data.size());
+}
+
+int main(int argc, char *argv[]) {
+	if(argc != 3) {
+		printf("usage: %s <input directory> <output directory>\n", argv[0]);
+		return 1;
+	}
+	std::string in = argv[1], out = argv[2];
+
+	BYTE work[FF_MAX_SS];
+	if(f_mkfs("0:", 0, work, sizeof(work)) != FR_OK || f_mkfs("1:", 0, work, sizeof(work)) != FR_OK
+			|| f_mount(&fs0, "0:", 1) != FR_OK || f_mount(&fs1, "1:", 1) != FR_OK) {
+		printf("Failed to create RAM disks\n");
+		return 1;
+	}
+
+	std::string info;
+	if(!readHostFile(in + "/info.txt", info)) {
+		printf("Failed to read info.txt\n");
+		return 1;
+	}
+	auto pos = info.find("Serial: ");
+	if(pos != std::string::npos) {
+		serial = info.substr(pos + 8, info.find_first_of("\r\n", pos) - pos - 8);
+	}
+	FIL f;
+	UINT bw;
+	if(f_open(&f, "1:/info.txt", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK
+			|| f_write(&f, info.data(), info.size(), &bw) != FR_OK || f_close(&f) != FR_OK) {
+		printf("Failed to store info.txt\n");
+		return 1;
+	}
+
+	Touchstone::EnableFactoryWriting();
+	const char *files[] = {
+		"P1_OPEN.s1p", "P1_SHORT.s1p", "P1_LOAD.s1p", "P2_OPEN.s1p", "P2_SHORT.s1p", "P2_LOAD.s1p",
+		"P3_OPEN.s1p", "P3_SHORT.s1p", "P3_LOAD.s1p", "P4_OPEN.s1p", "P4_SHORT.s1p", "P4_LOAD.s1p",
+		"P12_THROUGH.s2p", "P13_THROUGH.s2p", "P14_THROUGH.s2p", "P23_THROUGH.s2p", "P24_THROUGH.s2p", "P34_THROUGH.s2p",
+	};
+	for(auto name : files) {
+		std::string content;
+		if(!readHostFile(in + "/" + name, content)) {
+			printf("Failed to read %s\n", name);
+			return 1;
+		}
+		bool success = Touchstone::StartNewFile("FACTORY", name);
+		for(size_t i=0;i<content.size() && success;i+=1024) {
+			auto len = content.size() - i < 1024 ? content.size() - i : 1024;
+			success = Touchstone::WriteData((const uint8_t*) &content[i], len);
+		}
+		if(!Touchstone::FinishFile() || !success) {
+			printf("Failed to store %s\n", name);
+			return 1;
+		}
+	}
+
+	if(Siglent::SetSource("INCOMPLETE")) {
+		printf("Incomplete set accepted\n");
+		return 1;
+	}
+	if(!Siglent::SetSource("FACTORY")) {
+		printf("Failed to select the set\n");
+		return 1;
+	}
+	// the selection must survive a restart
+	Siglent::Init();
+	char set[50];
+	if(!Siglent::GetSource(set, sizeof(set)) || strcmp(set, "FACTORY") != 0) {
+		printf("Selection not restored\n");
+		return 1;
+	}
+
+	mkdir((out + "/siglent").c_str(), 0777);
+	if(!generate(Siglent::File::Info, out + "/siglent/info.dat")
+			|| !generate(Siglent::File::Data, out + "/siglent/data0.zip")) {
+		printf("Failed to generate the data\n");
+		return 1;
+	}
+
+	// no data is generated while any coefficient is being written
+	Touchstone::StartNewFile("OTHER", "P1_OPEN.s1p");
+	if(Siglent::Open(Siglent::File::Data) >= 0) {
+		printf("Data generated during a coefficient write\n");
+		return 1;
+	}
+	Touchstone::FinishFile();
+	if(Siglent::Open(Siglent::File::Data) < 0) {
+		printf("No data generated after the write\n");
+		return 1;
+	}
+
+	// a coefficient write invalidates the data, a partially read file ends early
+	Siglent::Open(Siglent::File::Data);
+	uint8_t buf[2048];
+	Siglent::Read(buf, sizeof(buf));
+	Touchstone::StartNewFile("FACTORY", "P1_OPEN.s1p");
+	Touchstone::FinishFile();
+	Siglent::Update();
+	if(Siglent::Read(buf, sizeof(buf)) != 0) {
+		printf("Stale data returned after an update\n");
+		return 1;
+	}
+	return 0;
+}
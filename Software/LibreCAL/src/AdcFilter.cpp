@@ -0,0 +1,50 @@
+#include "AdcFilter.hpp"
+
+float AdcFilter::MedianOfMeans(const volatile uint16_t *ring, uint16_t ringSize, uint16_t end, uint8_t groups, uint16_t groupSize) {
+	if(groups > MaxGroups) {
+		groups = MaxGroups;
+	}
+	uint32_t sums[MaxGroups] = {};
+	// start with the oldest sample, sample n belongs to group n % groups
+	uint16_t index = (end + ringSize - (groups * groupSize) % ringSize) % ringSize;
+	for(uint16_t i=0;i<groupSize;i++) {
+		for(uint8_t j=0;j<groups;j++) {
+			sums[j] += ring[index];
+			if(++index >= ringSize) {
+				index = 0;
+			}
+		}
+	}
+	// all groups have the same size, sorting the sums is sufficient
+	for(uint8_t i=1;i<groups;i++) {
+		uint32_t sum = sums[i];
+		uint8_t k = i;
+		while(k > 0 && sums[k - 1] > sum) {
+			sums[k] = sums[k - 1];
+			k--;
+		}
+		sums[k] = sum;
+	}
+	float median;
+	if(groups % 2) {
+		median = sums[groups / 2];
+	} else {
+		median = (sums[groups / 2 - 1] + sums[groups / 2]) / 2.0f;
+	}
+	return median / groupSize;
+}
+
+float AdcFilter::OffPhaseMedianOfMeans(const volatile uint16_t *ring, uint16_t ringSize, uint16_t end, uint16_t periodSamples,
+		uint16_t onSamples, uint8_t groups) {
+	if(groups > MaxGroups) {
+		groups = MaxGroups;
+	}
+	uint16_t offSamples = onSamples < periodSamples ? periodSamples - onSamples : 0;
+	uint16_t groupSize = offSamples / groups;
+	if(groupSize < MinGroupSize) {
+		// heater (almost) always on, the interference is a constant offset anyway
+		groupSize = periodSamples / groups;
+	}
+	// the off phase is at the end of the period
+	return MedianOfMeans(ring, ringSize, end, groups, groupSize);
+}
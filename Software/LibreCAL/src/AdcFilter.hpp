@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdint>
+
+// Decimation of oversampled ADC data
+namespace AdcFilter {
+
+static constexpr uint8_t MaxGroups = 32;
+
+// Takes the newest groups * groupSize samples of a ring buffer and returns the median of the group means.
+// The samples are assigned to the groups interleaved, so every group covers the whole time span. Periodic
+// interference (e.g. from the heater PWM) affects all groups equally, while an outlier only affects a
+// single group and is rejected by the median. end is the index after the newest sample.
+float MedianOfMeans(const volatile uint16_t *ring, uint16_t ringSize, uint16_t end, uint8_t groups, uint16_t groupSize);
+
+// Fewer samples per group are too noisy, see OffPhaseMedianOfMeans
+static constexpr uint16_t MinGroupSize = 5;
+
+// Median of means over one heater PWM period of periodSamples samples ending at end, leaving out the first
+// onSamples samples of the period (while the heater is on, plus the settling after switching it off). The
+// interference of the heater current averages to an offset over a whole period, it is only avoided by using
+// the off phase. If the off phase has less than groups * MinGroupSize samples, the whole period is used.
+float OffPhaseMedianOfMeans(const volatile uint16_t *ring, uint16_t ringSize, uint16_t end, uint16_t periodSamples,
+		uint16_t onSamples, uint8_t groups);
+
+}
@@ -0,0 +1,23 @@
+#include "FileSystem.hpp"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+static SemaphoreHandle_t mutex;
+static StaticSemaphore_t mutexBuffer;
+
+FileSystem::Lock::Lock() {
+	if(!mutex) {
+		taskENTER_CRITICAL();
+		if(!mutex) {
+			mutex = xSemaphoreCreateRecursiveMutexStatic(&mutexBuffer);
+		}
+		taskEXIT_CRITICAL();
+	}
+	xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+}
+
+FileSystem::Lock::~Lock() {
+	xSemaphoreGiveRecursive(mutex);
+}
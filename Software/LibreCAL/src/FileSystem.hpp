@@ -0,0 +1,21 @@
+#pragma once
+
+// Serialises the access to the FAT filesystems between tasks. FatFs is built without reentrancy and
+// the modules using it keep state of their own (e.g. the current directory and the open files of
+// Touchstone, the cached data of Siglent). The lock is recursive and taken for the duration of an
+// operation by the modules accessing the files.
+//
+// Must be taken before checking out a buffer from the scratch arena, otherwise two tasks could
+// deadlock.
+namespace FileSystem {
+
+// Holds the lock for the lifetime of the object
+class Lock {
+public:
+	Lock();
+	~Lock();
+	Lock(const Lock&) = delete;
+	Lock& operator=(const Lock&) = delete;
+};
+
+}
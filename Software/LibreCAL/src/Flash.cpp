@@ -1,7 +1,11 @@
 #include "Flash.hpp"
 
+#include "Perf.hpp"
+
 #include "FreeRTOS.h"
 #include "task.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 #include <cstring>
 
 #include <stdio.h>
@@ -10,6 +14,13 @@
 #define LOG_MODULE	"Flash"
 #include "Log.h"
 
+// Shorter reads are not worth the overhead of the DMA setup and the task switch
+static constexpr uint16_t MinDMALength = 64;
+// Only one flash uses the DMA
+static Flash *dmaFlash;
+// Index 0 of the task notifications is used by the SCPI task for the interface events
+static constexpr UBaseType_t DMANotificationIndex = 1;
+
 bool Flash::isPresent() {
 	xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
 	CS(false);
@@ -42,7 +53,11 @@ void Flash::read(uint32_t address, uint16_t length, void *dest) {
 	xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
 	initiateRead(address);
 	// read data
-	spi_read_blocking(spi, 0x00, (uint8_t*) dest, length);
+	if(length >= MinDMALength && xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+		readDMA((uint8_t*) dest, length);
+	} else {
+		spi_read_blocking(spi, 0x00, (uint8_t*) dest, length);
+	}
 	CS(true);
 	xSemaphoreGiveRecursive(mutex);
 }
@@ -77,9 +92,8 @@ bool Flash::write(uint32_t address, uint16_t length, const uint8_t *src) {
 			return false;
 		}
 		// Verify
-		uint8_t buf[256];
-		read(address, 256, buf);
-		if(memcmp(src, buf, 256)) {
+		read(address, 256, verifyBuffer);
+		if(memcmp(src, verifyBuffer, 256)) {
 			LOG_ERR("Verification error");
 			xSemaphoreGiveRecursive(mutex);
 			return false;
@@ -92,6 +106,63 @@ bool Flash::write(uint32_t address, uint16_t length, const uint8_t *src) {
 	return true;
 }
 
+void Flash::readDMA(uint8_t *dest, uint16_t length) {
+	if(rxDma < 0) {
+		rxDma = dma_claim_unused_channel(true);
+		txDma = dma_claim_unused_channel(true);
+		dmaFlash = this;
+		dma_channel_set_irq1_enabled(rxDma, true);
+		irq_add_shared_handler(DMA_IRQ_1, dmaIRQ, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+		irq_set_enabled(DMA_IRQ_1, true);
+	}
+	// the transmitted bytes are don't care, always send the same zero byte
+	static const uint8_t zero = 0x00;
+	auto tx = dma_channel_get_default_config(txDma);
+	channel_config_set_transfer_data_size(&tx, DMA_SIZE_8);
+	channel_config_set_read_increment(&tx, false);
+	channel_config_set_write_increment(&tx, false);
+	channel_config_set_dreq(&tx, spi_get_dreq(spi, true));
+	auto rx = dma_channel_get_default_config(rxDma);
+	channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+	channel_config_set_read_increment(&rx, false);
+	channel_config_set_write_increment(&rx, true);
+	channel_config_set_dreq(&rx, spi_get_dreq(spi, false));
+
+	// the command bytes have been received into the FIFO, discard them
+	while(spi_is_readable(spi)) {
+		(void) spi_get_hw(spi)->dr;
+	}
+	dmaWaiting = xTaskGetCurrentTaskHandle();
+	dma_channel_configure(rxDma, &rx, dest, &spi_get_hw(spi)->dr, length, false);
+	dma_channel_configure(txDma, &tx, &spi_get_hw(spi)->dr, &zero, length, false);
+	dma_start_channel_mask((1u << rxDma) | (1u << txDma));
+	// the RX channel finishes last, one byte per byte sent. The channels must be stopped before
+	// the caller releases CS and dest goes out of scope
+	if(!ulTaskNotifyTakeIndexed(DMANotificationIndex, pdTRUE, pdMS_TO_TICKS(100))
+			|| dma_channel_is_busy(rxDma)) {
+		LOG_ERR("DMA read timed out");
+		dma_channel_abort(rxDma);
+		dma_channel_abort(txDma);
+		// discard a notification of the aborted transfer
+		ulTaskNotifyTakeIndexed(DMANotificationIndex, pdTRUE, 0);
+	}
+	dmaWaiting = nullptr;
+}
+
+void Flash::dmaIRQ() {
+	auto f = dmaFlash;
+	if(!f || !dma_channel_get_irq1_status(f->rxDma)) {
+		// not for this channel
+		return;
+	}
+	dma_channel_acknowledge_irq1(f->rxDma);
+	BaseType_t woken = pdFALSE;
+	if(f->dmaWaiting) {
+		vTaskNotifyGiveIndexedFromISR(f->dmaWaiting, DMANotificationIndex, &woken);
+	}
+	portYIELD_FROM_ISR(woken);
+}
+
 void Flash::EnableWrite() {
 	CS(false);
 	// enable write latch
@@ -185,6 +256,7 @@ void Flash::initiateRead(uint32_t address) {
 }
 
 bool Flash::WaitBusy(uint32_t timeout) {
+	auto start = Perf::Now();
 	uint32_t starttime = xTaskGetTickCount();
 	CS(false);
 	uint8_t readStatus1 = 0x05;
@@ -195,11 +267,13 @@ bool Flash::WaitBusy(uint32_t timeout) {
 		spi_read_blocking(spi, 0x00, &status1, 1);
 		if (!(status1 & 0x01)) {
 			CS(true);
+			Perf::Record(Perf::Section::FlashWaitBusy, start);
 			return true;
 		}
 	} while (xTaskGetTickCount() - starttime < timeout);
 	// timed out
 	CS(true);
+	Perf::Record(Perf::Section::FlashWaitBusy, start);
 	LOG_ERR("Timeout occurred");
 	return false;
 }
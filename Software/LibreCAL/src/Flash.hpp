@@ -10,6 +10,7 @@
 
 #include "FreeRTOS.h"
 #include "semphr.h"
+#include "task.h"
 
 #include "hardware/spi.h"
 #include "hardware/gpio.h"
@@ -21,6 +22,8 @@ public:
 	: spi(spi),SCLK_pin(SCLK_pin),MOSI_pin(MOSI_pin),MISO_pin(MISO_pin),CS_pin(CS_pin){
 		mutex = xSemaphoreCreateMutex();
 		totalSize = 0;
+		rxDma = txDma = -1;
+		dmaWaiting = nullptr;
 	};
 
 	bool isPresent();
@@ -49,12 +52,20 @@ private:
 	}
 	// Starts the reading process without actually reading any bytes
 	void initiateRead(uint32_t address);
+	// Reads from the SPI by DMA, the calling task is blocked (instead of polling the SPI) until
+	// the transfer is complete. Other tasks (e.g. USB) run in the meantime
+	void readDMA(uint8_t *dest, uint16_t length);
+	static void dmaIRQ();
 	void EnableWrite();
 	bool WaitBusy(uint32_t timeout);
 	spi_inst_t * const spi;
 	const uint8_t CS_pin, MISO_pin, MOSI_pin, SCLK_pin;
 	SemaphoreHandle_t mutex;
 	uint32_t totalSize;
+	// written pages are read back into this buffer, protected by the mutex
+	uint8_t verifyBuffer[PageSize];
+	int rxDma, txDma;
+	TaskHandle_t dmaWaiting;
 };
 
 
@@ -73,8 +73,20 @@
 #define configUSE_DAEMON_TASK_STARTUP_HOOK      0
 
 /* Run time and task stats gathering related definitions. */
-#define configGENERATE_RUN_TIME_STATS           0
-#define configUSE_TRACE_FACILITY                0
+#define configGENERATE_RUN_TIME_STATS           1           // for the CPU share of :SYSTem:TASKs?
+#define configRUN_TIME_COUNTER_TYPE             uint64_t    // microseconds, does not overflow
+/* The microsecond timer of the RP2040 is always running, no configuration required. The kernel
+ * is built without the Pico SDK headers, the timer is read in freertos.c */
+#define portCONFIGURE_TIMER_FOR_RUN_TIME_STATS()
+#define portGET_RUN_TIME_COUNTER_VALUE()        ullGetRunTimeCounterValue()
+#ifdef __cplusplus
+extern "C" {
+#endif
+uint64_t ullGetRunTimeCounterValue( void );
+#ifdef __cplusplus
+}
+#endif
+#define configUSE_TRACE_FACILITY                1           // for the task lists of :SYSTem:MEMory? and :SYSTem:TASKs?
 #define configUSE_STATS_FORMATTING_FUNCTIONS    0
 
 /* Co-routine related definitions. */
@@ -100,7 +112,7 @@
 #define INCLUDE_vTaskDelay                      1
 #define INCLUDE_xTaskGetSchedulerState          1
 #define INCLUDE_xTaskGetCurrentTaskHandle       1
-#define INCLUDE_uxTaskGetStackHighWaterMark     0
+#define INCLUDE_uxTaskGetStackHighWaterMark     1
 #define INCLUDE_xTaskGetIdleTaskHandle          0
 #define INCLUDE_eTaskGetState                   0
 #define INCLUDE_xEventGroupSetBitFromISR        1
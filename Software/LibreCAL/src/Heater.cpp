@@ -1,49 +1,194 @@
 #include "Heater.hpp"
 
+#include "Status.hpp"
+#include "HeaterControl.hpp"
+#include "AdcFilter.hpp"
+#include "Scratch.hpp"
+#include "FileSystem.hpp"
+
 #include "pico/stdlib.h"
 #include "hardware/pwm.h"
 #include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "ff.h"
 
 #include <cmath>
+#include <cstring>
+#include <cstdlib>
+
+// Identified thermal model of this board (stored on the factory partition)
+static constexpr char parameterFile[] = "1:heater.txt";
 
 static uint8_t target;
 static bool stable = false;
 static float temp;
 static float power;
 
+static HeaterControl::Parameters parameters = HeaterControl::DefaultParameters;
+// set when the parameters have been changed outside of the heater task
+static volatile bool parametersChanged = false;
+static volatile bool tuneRequested = false;
+static volatile HeaterControl::Identification::State tuneState = HeaterControl::Identification::State::Idle;
+
 using namespace Heater;
 
+// Written by the heater task only. Readers check the sequence number of a slot before and after
+// copying it to detect entries that were overwritten in the meantime
+struct HistoryRecord {
+	volatile uint32_t seq;
+	HistoryEntry entry;
+};
+
+static HistoryRecord history[HistorySize];
+static volatile uint32_t historyCount;
+
+static void AddHistory() {
+	uint32_t n = historyCount;
+	auto &r = history[n % HistorySize];
+	// invalidate the slot while it is written
+	r.seq = 0;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	r.entry.time = xTaskGetTickCount();
+	r.entry.temperature = temp;
+	r.entry.power = power;
+	r.entry.stable = stable;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	r.seq = n + 1;
+	historyCount = n + 1;
+}
+
+// The ADC runs continuously and the samples are transferred into a ring buffer by DMA. Every control
+// period uses the samples of the last PWM period, split into groups for the median rejection. The heater
+// current disturbs the ADC while the PWM output is high, so only the samples after the heater has been
+// switched off are used. The PWM wrap interrupt marks the period boundaries in the ring buffer
+static constexpr uint32_t AdcSampleRate = 20000;
+// holds the last complete PWM period (~1000 samples) while the next one is being sampled
+static constexpr uint16_t AdcRingSize = 2048; // must be a power of two
+static constexpr uint8_t AdcGroups = 20;
+static constexpr uint16_t AdcGroupSize = 50;
+static_assert(AdcGroups * AdcGroupSize <= AdcRingSize, "Not enough samples in the ring buffer");
+// samples skipped after the heater has been switched off (1ms)
+static constexpr uint16_t AdcSettleSamples = 20;
+
+// aligned to its size as required by the DMA ring mode
+static volatile uint16_t adcRing[AdcRingSize] __attribute__((aligned(AdcRingSize * sizeof(uint16_t))));
+static uint adcDma;
+
+// PWM level written by the heater task, it becomes active at the next wrap
+static volatile uint16_t pwmLevel;
+// Boundaries of the last complete PWM period in the ring buffer and the PWM level during it
+struct PWMPeriod {
+	uint16_t start;
+	uint16_t end;
+	uint16_t level;
+	bool valid;
+};
+static PWMPeriod lastPeriod;
+static PWMPeriod currentPeriod;
+static TaskHandle_t heaterTask;
+
+static uint16_t adcWriteIndex() {
+	return ((dma_channel_hw_addr(adcDma)->write_addr - (uintptr_t) adcRing) / sizeof(adcRing[0])) % AdcRingSize;
+}
+
+static void pwmIRQ() {
+	uint slice = pwm_gpio_to_slice_num(PWMPin);
+	if(!(pwm_get_irq_status_mask() & (1u << slice))) {
+		// not for this slice
+		return;
+	}
+	pwm_clear_irq(slice);
+	uint16_t index = adcWriteIndex();
+	currentPeriod.end = index;
+	lastPeriod = currentPeriod;
+	currentPeriod.start = index;
+	currentPeriod.level = pwmLevel;
+	currentPeriod.valid = true;
+	BaseType_t woken = pdFALSE;
+	if(heaterTask) {
+		vTaskNotifyGiveFromISR(heaterTask, &woken);
+	}
+	portYIELD_FROM_ISR(woken);
+}
+
+static void startADC() {
+	adc_fifo_setup(true, true, 1, false, false);
+	// ADC is clocked with 48MHz
+	adc_set_clkdiv(48000000 / AdcSampleRate - 1);
+
+	adcDma = dma_claim_unused_channel(true);
+	auto c = dma_channel_get_default_config(adcDma);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+	channel_config_set_read_increment(&c, false);
+	channel_config_set_write_increment(&c, true);
+	channel_config_set_ring(&c, true, __builtin_ctz(sizeof(adcRing)));
+	channel_config_set_dreq(&c, DREQ_ADC);
+	dma_channel_configure(adcDma, &c, adcRing, &adc_hw->fifo, UINT32_MAX, true);
+	adc_run(true);
+}
+
+static float readADC() {
+	if(!dma_channel_is_busy(adcDma)) {
+		// transfer count exhausted (after more than two days), continue at the current position in the ring
+		dma_channel_set_trans_count(adcDma, UINT32_MAX, true);
+	}
+	taskENTER_CRITICAL();
+	auto period = lastPeriod;
+	uint16_t end = adcWriteIndex();
+	taskEXIT_CRITICAL();
+	uint16_t samples = (period.end + AdcRingSize - period.start) % AdcRingSize;
+	uint16_t sinceStart = (end + AdcRingSize - period.start) % AdcRingSize;
+	if(!period.valid || samples < AdcGroups * AdcGroupSize / 2 || sinceStart < samples) {
+		// no PWM interrupt yet, the period is implausible or the ring buffer has already wrapped around.
+		// Fall back to the newest samples, the heater interference adds an offset to those
+		return AdcFilter::MedianOfMeans(adcRing, AdcRingSize, end, AdcGroups, AdcGroupSize);
+	}
+	uint16_t onSamples = 0;
+	if(period.level) {
+		onSamples = ((uint32_t) period.level * samples + UINT16_MAX) / (UINT16_MAX + 1) + AdcSettleSamples;
+	}
+	return AdcFilter::OffPhaseMedianOfMeans(adcRing, AdcRingSize, period.end, samples, onSamples, AdcGroups);
+}
+
 static void setPWM(uint16_t power) {
 	uint slice = pwm_gpio_to_slice_num(PWMPin);
 	uint channel = pwm_gpio_to_channel(PWMPin);
+	pwmLevel = power;
 	pwm_set_chan_level(slice, channel, power);
 }
 
+// State of the control loop for the time-to-stable prediction, copied once per second. Running the
+// prediction takes too long for the control loop, it is calculated by the caller of GetTimeToStable()
+static struct {
+	HeaterControl::Controller controller;
+	HeaterControl::StabilityDetector detector;
+	float temp;
+	float slope; // in °C/s
+	uint8_t target;
+	bool valid; // not while the thermal model is identified
+} predictionState;
+
 void HeaterTask(void*) {
-	// Controller parameters
-	constexpr float assumed_ambient = 22.0f; // in °C
-	constexpr float thermal_resistance = 30.0f; // in °C/W
-	constexpr float P = 0.4f; // in W/delta°C
-	constexpr float I = 0.05f; // in W/delta°C/s
-	constexpr float I_limit = 2.0f;
+	// one control step per PWM period
 	constexpr float ControllerPeriod = 0.05;
 
-	// Stable check paramters
-	constexpr float allowedDeviation = 0.25f;
-	constexpr uint16_t minStableTime = 60000;
-
-	static constexpr float alpha = 0.95;
-	float adc_avg = adc_read();
-	float integral = 0.0f;
+	// wait until the ring buffer contains a complete PWM period
+	ulTaskNotifyTake(pdTRUE, ControllerPeriod * 1000 * 2);
+	ulTaskNotifyTake(pdTRUE, ControllerPeriod * 1000 * 2);
 
-	uint32_t lastUnstableTime = xTaskGetTickCount();
+	HeaterControl::Controller controller(parameters);
+	HeaterControl::StabilityDetector detector;
+	uint32_t lastHistory = xTaskGetTickCount() - HistoryInterval;
+	HeaterControl::Identification identification;
+	bool first = true;
 
 	while(1) {
 
-		adc_avg = adc_read() * (1.0f - alpha) + adc_avg * alpha;
+		float adc_avg = readADC();
 		// Reference resistor is 10k, NTC has additional 100 Ohm in series
 		float NTC_resistance = adc_avg / (4096 - adc_avg) * 10000 - 100;
 		constexpr float NTC_nominal = 10000.0f;
@@ -52,25 +197,33 @@ void HeaterTask(void*) {
 		constexpr float Tzero = 273.15f;
 		temp = (T0 + Tzero) * NTC_B / ((T0 + Tzero) * logf(NTC_resistance / NTC_nominal) + NTC_B) - Tzero;
 
-		float basePower = (temp - assumed_ambient) / thermal_resistance; // required power to hold current temperature
-		float deviation = target - temp;
-		if(power < maxPower || power > 0) {
-			// only update integral term when not already at control limit
-			integral += deviation * I * ControllerPeriod;
+		if(first) {
+			controller.Reset(temp, target);
+			// no slope for the first prediction (not used before valid is set)
+			predictionState.temp = temp;
+			first = false;
 		}
-		// anti windup
-		if(integral > I_limit) {
-			integral = I_limit;
-		} else if(integral < -I_limit) {
-			integral = -I_limit;
+		if(parametersChanged) {
+			parametersChanged = false;
+			controller.SetParameters(parameters);
 		}
-		float p = deviation * P + integral;
-		if(p > maxPower) {
-			p = maxPower;
-		} else if(p < 0) {
-			p = 0;
+		if(tuneRequested) {
+			tuneRequested = false;
+			identification.Start(temp, maxPower);
+		}
+		if(identification.IsRunning()) {
+			// the normal control loop is suspended while tuning
+			power = identification.Update(temp, ControllerPeriod);
+			tuneState = identification.GetState();
+			if(tuneState == HeaterControl::Identification::State::Done) {
+				parameters.thermalResistance = identification.GetResistance();
+				parameters.thermalCapacity = identification.GetCapacity();
+				controller.SetParameters(parameters);
+				controller.SetAmbient(identification.GetAmbient());
+			}
+		} else {
+			power = controller.Update(temp, target, ControllerPeriod);
 		}
-		power = p;
 
 		// convert power to PWM, maximum power is approximately 1.9W
 		int32_t pwm = power * UINT16_MAX / maxPower;
@@ -82,14 +235,31 @@ void HeaterTask(void*) {
 		setPWM(pwm);
 
 		// check if temperature is stable
-		if(fabs(temp - target) > allowedDeviation) {
+		if(identification.IsRunning()) {
+			detector.Reset();
 			stable = false;
-			lastUnstableTime = xTaskGetTickCount();
-		} else if(xTaskGetTickCount() - lastUnstableTime > minStableTime) {
-			stable = true;
+		} else {
+			stable = detector.Update(temp, target, ControllerPeriod);
+		}
+		Status::SetCondition(Status::Condition::TemperatureStable, stable);
+
+		if(xTaskGetTickCount() - lastHistory >= HistoryInterval) {
+			lastHistory += HistoryInterval;
+			AddHistory();
+			// the prediction is not worth updating more often
+			taskENTER_CRITICAL();
+			predictionState.slope = (temp - predictionState.temp) * 1000 / HistoryInterval;
+			predictionState.controller = controller;
+			predictionState.detector = detector;
+			predictionState.temp = temp;
+			predictionState.target = target;
+			predictionState.valid = !identification.IsRunning();
+			taskEXIT_CRITICAL();
 		}
 
-		vTaskDelay(ControllerPeriod * 1000);
+		// the new PWM level is active from the next wrap on. The timeout keeps the control loop
+		// running (with the unsynchronised ADC reading) should the PWM interrupt ever be missing
+		ulTaskNotifyTake(pdTRUE, ControllerPeriod * 1000 * 2);
 	}
 }
 
@@ -100,19 +270,29 @@ void Heater::Init() {
 	pwm_set_clkdiv(slice, 95.38f); // for 20Hz PWM
 	pwm_set_wrap(slice, UINT16_MAX);
 	setPWM(0);
-	pwm_set_enabled(slice, true);
 
 	adc_init();
 	adc_gpio_init(ADCPin);
 	adc_select_input(ADCPin - 26);
+	startADC();
+
+	xTaskCreate(HeaterTask, "Heater", 512, NULL, 3, &heaterTask);
 
-	xTaskCreate(HeaterTask, "Heater", 512, NULL, 3, NULL);
+	pwm_clear_irq(slice);
+	pwm_set_irq_enabled(slice, true);
+	irq_add_shared_handler(PWM_IRQ_WRAP, pwmIRQ, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+	irq_set_enabled(PWM_IRQ_WRAP, true);
+	pwm_set_enabled(slice, true);
 }
 
 void Heater::SetTarget(uint8_t celsius) {
 	target = celsius;
 }
 
+uint8_t Heater::GetTarget() {
+	return target;
+}
+
 float Heater::GetTemp() {
 	return temp;
 }
@@ -124,3 +304,95 @@ bool Heater::IsStable() {
 float Heater::GetPower() {
 	return power;
 }
+
+float Heater::GetTimeToStable() {
+	taskENTER_CRITICAL();
+	auto s = predictionState;
+	taskEXIT_CRITICAL();
+	if(!s.valid) {
+		return -1;
+	}
+	return HeaterControl::PredictTimeToStable(s.controller, s.detector, s.temp, s.slope, s.target);
+}
+
+uint16_t Heater::GetHistory(HistoryEntry *entries, uint16_t maxEntries, uint32_t since) {
+	uint32_t end = historyCount;
+	uint32_t start = end > HistorySize ? end - HistorySize : 0;
+	uint16_t cnt = 0;
+	for(uint32_t n=start;n<end && cnt < maxEntries;n++) {
+		auto &r = history[n % HistorySize];
+		if(r.seq != n + 1) {
+			// already overwritten
+			continue;
+		}
+		entries[cnt] = r.entry;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if(r.seq != n + 1 || entries[cnt].time <= since) {
+			// overwritten while copying or not newer than requested
+			continue;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+
+bool Heater::StartTuning() {
+	if(tuneState == HeaterControl::Identification::State::Heating
+			|| tuneState == HeaterControl::Identification::State::Cooling || tuneRequested) {
+		// already running
+		return false;
+	}
+	tuneState = HeaterControl::Identification::State::Heating;
+	tuneRequested = true;
+	return true;
+}
+
+HeaterControl::Identification::State Heater::GetTuningState() {
+	return tuneState;
+}
+
+void Heater::GetModel(float &resistance, float &capacity) {
+	resistance = parameters.thermalResistance;
+	capacity = parameters.thermalCapacity;
+}
+
+bool Heater::SaveParameters() {
+	FileSystem::Lock lock;
+	Scratch::Buffer<FIL> f;
+	if(!f || f_open(f, parameterFile, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+		return false;
+	}
+	bool success = f_printf(f, "ThermalResistance: %f\r\n", parameters.thermalResistance) > 0
+			&& f_printf(f, "ThermalCapacity: %f\r\n", parameters.thermalCapacity) > 0;
+	return f_close(f) == FR_OK && success;
+}
+
+void Heater::LoadParameters() {
+	FileSystem::Lock lock;
+	Scratch::Buffer<FIL> f;
+	if(!f || f_open(f, parameterFile, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+		// not tuned yet, keep the default parameters
+		return;
+	}
+	auto p = parameters;
+	char line[64];
+	while(f_gets(line, sizeof(line), f)) {
+		auto value = strchr(line, ':');
+		if(!value) {
+			continue;
+		}
+		*value++ = '\0';
+		float v = strtof(value, NULL);
+		if(v <= 0) {
+			continue;
+		}
+		if(strcmp(line, "ThermalResistance") == 0) {
+			p.thermalResistance = v;
+		} else if(strcmp(line, "ThermalCapacity") == 0) {
+			p.thermalCapacity = v;
+		}
+	}
+	f_close(f);
+	parameters = p;
+	parametersChanged = true;
+}
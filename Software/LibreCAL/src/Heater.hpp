@@ -10,6 +10,8 @@
 
 #include <cstdint>
 
+#include "HeaterControl.hpp"
+
 namespace Heater {
 
 static constexpr uint8_t PWMPin = 28;
@@ -17,11 +19,37 @@ static constexpr uint8_t ADCPin = 29;
 
 static constexpr float maxPower = 1.9f;
 
+struct HistoryEntry {
+	uint32_t time; // in ms since power-up
+	float temperature;
+	float power;
+	bool stable;
+};
+
+// One sample per second is recorded, covering the last five minutes
+static constexpr uint16_t HistorySize = 300;
+static constexpr uint16_t HistoryInterval = 1000;
+
 void Init();
 void SetTarget(uint8_t celsius);
+uint8_t GetTarget();
 float GetTemp();
 bool IsStable();
 float GetPower();
+// Predicted time in s until the temperature is stable (0 if already stable), negative if unknown.
+// The prediction is calculated in the calling task and takes a while (see HeaterControl::PredictTimeToStable)
+float GetTimeToStable();
+// Copies the recorded samples taken after since (in ms) in chronological order, returns the number of entries
+uint16_t GetHistory(HistoryEntry *entries, uint16_t maxEntries, uint32_t since = 0);
+
+// Identifies the thermal model of the board. The temperature is not regulated while this is running
+bool StartTuning();
+HeaterControl::Identification::State GetTuningState();
+void GetModel(float &resistance, float &capacity);
+// Stores the current thermal model on the factory partition
+bool SaveParameters();
+// Loads a stored thermal model, requires the mounted filesystem
+void LoadParameters();
 
 };
 
@@ -0,0 +1,235 @@
+#include "HeaterControl.hpp"
+
+#include <cmath>
+
+using namespace HeaterControl;
+
+Controller::Controller(const Parameters &p) :
+	p(p), ambient(p.ambient), integral(0.0f) {
+}
+
+void Controller::SetParameters(const Parameters &p) {
+	this->p = p;
+}
+
+void Controller::Reset(float temp, float target) {
+	// At power-up the board is at ambient temperature. After a reset of a warm board, fall
+	// back to the assumed ambient temperature, the integral corrects the remaining error
+	if(temp < target && fabsf(temp - p.ambient) < 10.0f) {
+		ambient = temp;
+	} else {
+		ambient = p.ambient;
+	}
+	integral = 0.0f;
+}
+
+float Controller::Update(float temp, float target, float dt) {
+	float deviation = target - temp;
+	float hold = (temp - ambient) / p.thermalResistance;
+	float approach = deviation * p.thermalCapacity / p.responseTime;
+	float power = hold + approach + integral;
+	bool saturated = (power >= p.maxPower && deviation > 0) || (power <= 0 && deviation < 0);
+	if(fabsf(deviation) < p.I_range && !saturated) {
+		integral += deviation * p.I * dt;
+		if(integral > p.I_limit) {
+			integral = p.I_limit;
+		} else if(integral < -p.I_limit) {
+			integral = -p.I_limit;
+		}
+	}
+	if(power > p.maxPower) {
+		power = p.maxPower;
+	} else if(power < 0) {
+		power = 0;
+	}
+	return power;
+}
+
+StabilityDetector::StabilityDetector() {
+	Reset();
+}
+
+void StabilityDetector::Reset() {
+	blockSum = 0;
+	blockTime = 0;
+	blockSamples = 0;
+	numBlocks = 0;
+	nextBlock = 0;
+	stable = false;
+}
+
+bool StabilityDetector::Update(float temp, float target, float dt) {
+	if(fabsf(temp - target) > allowedDeviation) {
+		// every sample has to be within the allowed deviation, start again
+		Reset();
+		return false;
+	}
+	blockSum += temp;
+	blockSamples++;
+	blockTime += dt;
+	if(blockTime < BlockTime) {
+		return stable;
+	}
+	// block complete, add its mean to the window
+	blocks[nextBlock] = blockSum / blockSamples;
+	nextBlock = (nextBlock + 1) % WindowBlocks;
+	if(numBlocks < WindowBlocks) {
+		numBlocks++;
+	}
+	blockSum = 0;
+	blockSamples = 0;
+	blockTime = 0;
+	if(numBlocks < WindowBlocks || stable) {
+		// Not enough data yet. Once stable, only a sample outside of the allowed deviation
+		// revokes the stable state (small trends at the limit would otherwise toggle it)
+		return stable;
+	}
+	// linear regression over the block means (oldest block at x = 0)
+	float sumY = 0, sumXY = 0;
+	for(uint8_t i=0;i<WindowBlocks;i++) {
+		float y = blocks[(nextBlock + i) % WindowBlocks] - target;
+		sumY += y;
+		sumXY += i * y;
+	}
+	constexpr float n = WindowBlocks;
+	constexpr float sumX = n * (n - 1) / 2;
+	constexpr float sumXX = (n - 1) * n * (2 * n - 1) / 6;
+	float slope = (n * sumXY - sumX * sumY) / (n * sumXX - sumX * sumX) / BlockTime;
+	float mean = sumY / n;
+	stable = fabsf(mean) < allowedMeanDeviation && fabsf(slope) < allowedSlope;
+	return stable;
+}
+
+float HeaterControl::PredictTimeToStable(Controller controller, StabilityDetector detector, float temp, float slope, float target,
+		float maxTime) {
+	if(detector.IsStable()) {
+		return 0;
+	}
+	// The detector averages over blocks anyway, larger steps keep the prediction cheap
+	constexpr float dt = StabilityDetector::BlockTime;
+	auto &p = controller.GetParameters();
+	// The board is assumed to follow the model exactly. The integral is not taken as an error of the model,
+	// while approaching the target it is still winding up and causes an overshoot that delays the stable state
+	// the sensor lags behind the board
+	float board = temp + slope * p.sensorDelay;
+	float sensorStep = dt < p.sensorDelay ? dt / p.sensorDelay : 1.0f;
+	for(float t=dt;t<=maxTime;t+=dt) {
+		float power = controller.Update(temp, target, dt);
+		board += (power - (board - controller.GetAmbient()) / p.thermalResistance) / p.thermalCapacity * dt;
+		temp += (board - temp) * sensorStep;
+		if(detector.Update(temp, target, dt)) {
+			return t;
+		}
+	}
+	return -1;
+}
+
+Identification::Identification() :
+	state(State::Idle), resistance(0), capacity(0), ambient(0) {
+}
+
+void Identification::Start(float temp, float maxPower) {
+	state = State::Heating;
+	power = maxPower;
+	startTemp = temp;
+	phaseTime = 0;
+	blockSum = 0;
+	blockTime = 0;
+	blockSamples = 0;
+	blocks = 0;
+	heating = {};
+	cooling = {};
+}
+
+void Identification::AddBlock(float temp, float slope) {
+	float t = temp - startTemp;
+	if(state == State::Heating) {
+		heating.n++;
+		heating.sumT += t;
+		heating.sumY += slope;
+	} else {
+		cooling.n++;
+		cooling.sumT += t;
+		cooling.sumTT += t * t;
+		cooling.sumY += slope;
+		cooling.sumTY += t * slope;
+	}
+}
+
+float Identification::Update(float temp, float dt) {
+	if(!IsRunning()) {
+		return 0;
+	}
+	phaseTime += dt;
+	blockSum += temp;
+	blockSamples++;
+	blockTime += dt;
+	if(blockTime >= BlockTime) {
+		float mean = blockSum / blockSamples;
+		if(blocks > (state == State::Heating ? SkipBlocksHeating : SkipBlocksCooling)) {
+			AddBlock((mean + lastBlock) / 2, (mean - lastBlock) / blockTime);
+		}
+		lastBlock = mean;
+		blocks++;
+		blockSum = 0;
+		blockSamples = 0;
+		blockTime = 0;
+	}
+	if(state == State::Heating) {
+		if(temp >= startTemp + TemperatureRise || temp >= MaxTemperature || phaseTime >= MaxHeatingTime) {
+			state = State::Cooling;
+			phaseTime = 0;
+			blocks = 0;
+			blockSum = 0;
+			blockSamples = 0;
+			blockTime = 0;
+		}
+	} else if(phaseTime >= CoolingTime) {
+		Solve();
+	}
+	return state == State::Heating ? power : 0;
+}
+
+void Identification::Solve() {
+	state = State::Failed;
+	if(heating.n < 10 || cooling.n < 10) {
+		return;
+	}
+	// cooling: slope = b * t + c with b = -1/(R*C) and c = (Ta - startTemp)/(R*C)
+	float n = cooling.n;
+	float det = n * cooling.sumTT - cooling.sumT * cooling.sumT;
+	if(det <= 0) {
+		return;
+	}
+	float b = (n * cooling.sumTY - cooling.sumT * cooling.sumY) / det;
+	float c = (cooling.sumY - b * cooling.sumT) / n;
+	if(b >= 0) {
+		return;
+	}
+	// heating: slope = P/C + b * t + c, the remainder after the losses is the heating rate
+	float rate = (heating.sumY - b * heating.sumT - c * heating.n) / heating.n;
+	if(rate <= 0) {
+		return;
+	}
+	capacity = power / rate;
+	resistance = -1.0f / (b * capacity);
+	ambient = startTemp - c / b;
+	// reject results that can not be right for this board
+	if(resistance < 5.0f || resistance > 200.0f || capacity < 2.0f || capacity > 200.0f
+			|| ambient < -10.0f || ambient > 50.0f) {
+		return;
+	}
+	state = State::Done;
+}
+
+const char* Identification::StateName(State s) {
+	switch(s) {
+	case State::Idle: return "IDLE";
+	case State::Heating: return "HEATING";
+	case State::Cooling: return "COOLING";
+	case State::Done: return "DONE";
+	case State::Failed:
+	default:
+		return "FAILED";
+	}
+}
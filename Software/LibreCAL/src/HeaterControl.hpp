@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstdint>
+
+// Temperature controller and stability detection of the heater. Independent of the hardware,
+// this is also used by the host simulation in sim/
+namespace HeaterControl {
+
+struct Parameters {
+	float ambient; // assumed ambient temperature in °C, used until it can be estimated
+	float thermalResistance; // in °C/W
+	float thermalCapacity; // in J/°C
+	float responseTime; // desired time constant of the approach to the target in s
+	float I; // in W/delta°C/s
+	float I_limit; // in W
+	float I_range; // integral is only updated within this deviation from the target in °C
+	float maxPower; // in W
+	float sensorDelay; // time constant of the NTC following the board in s (assumed, not identified)
+};
+
+static constexpr Parameters DefaultParameters = {
+	.ambient = 22.0f,
+	.thermalResistance = 30.0f,
+	.thermalCapacity = 20.0f,
+	.responseTime = 20.0f,
+	.I = 0.01f,
+	.I_limit = 0.5f,
+	.I_range = 1.0f,
+	.maxPower = 1.9f,
+	.sensorDelay = 5.0f,
+};
+
+// Model based controller: the thermal model provides the power that is required to hold the current
+// temperature plus the power to approach the target with the desired time constant. An integral
+// term only corrects the remaining model error close to the target.
+class Controller {
+public:
+	Controller(const Parameters &p = DefaultParameters);
+
+	void SetParameters(const Parameters &p);
+	const Parameters& GetParameters() const { return p; }
+
+	// Called with the first temperature measurement. A board that is colder than the target
+	// has been powered up from ambient temperature
+	void Reset(float temp, float target);
+	// Returns the heater power in W
+	float Update(float temp, float target, float dt);
+	void SetAmbient(float ambient) { this->ambient = ambient; }
+	float GetAmbient() const { return ambient; }
+	float GetIntegral() const { return integral; }
+
+private:
+	Parameters p;
+	float ambient;
+	float integral;
+};
+
+// Declares the temperature stable once the (block averaged) temperature is close to the target,
+// has no remaining trend and every sample stays within the allowed deviation. The stable state
+// is kept until a sample exceeds the allowed deviation
+class StabilityDetector {
+public:
+	static constexpr float BlockTime = 1.0f; // in s
+	static constexpr uint8_t WindowBlocks = 20;
+	static constexpr float allowedDeviation = 0.25f; // for every single sample in °C
+	static constexpr float allowedMeanDeviation = 0.1f; // for the mean over the window in °C
+	static constexpr float allowedSlope = 0.002f; // in °C/s
+
+	StabilityDetector();
+
+	void Reset();
+	// Returns true if the temperature is stable
+	bool Update(float temp, float target, float dt);
+	bool IsStable() const { return stable; }
+
+private:
+	float blockSum;
+	float blockTime;
+	uint16_t blockSamples;
+	float blocks[WindowBlocks];
+	uint8_t numBlocks;
+	uint8_t nextBlock;
+	bool stable;
+};
+
+// Predicts the time until the detector reports a stable temperature. Copies of the controller and the
+// detector are run against the thermal model and the sensor delay, starting at the current temperature
+// and with the time the temperature has already spent close to the target. The board is assumed to be
+// ahead of the sensor by slope (in °C/s) times the sensor delay. The model is assumed to be exact and the
+// noise is not modeled, so this is an estimate only (see sim/heater_sim.cpp for its accuracy). Returns a negative value if the temperature is not expected to become stable within
+// maxTime. This takes up to maxTime / StabilityDetector::BlockTime model steps, too many for the control loop
+static constexpr float MaxPredictionTime = 900.0f; // in s
+float PredictTimeToStable(Controller controller, StabilityDetector detector, float temp, float slope, float target,
+		float maxTime = MaxPredictionTime);
+
+// Identifies the thermal model (resistance, capacity and ambient temperature) from the response to a
+// power step. The heater runs at full power until the temperature has risen, then it is turned off.
+// The cooling curve (block averaged) is fitted to dT/dt = -(T - Ta)/(R*C), which yields R*C and Ta.
+// The capacity follows from the temperature rise during heating.
+class Identification {
+public:
+	enum class State : uint8_t {
+		Idle,
+		Heating,
+		Cooling,
+		Done,
+		Failed,
+	};
+
+	static constexpr float BlockTime = 1.0f; // in s
+	static constexpr float TemperatureRise = 6.0f; // in °C
+	static constexpr float MaxTemperature = 50.0f; // in °C
+	static constexpr float MaxHeatingTime = 600.0f; // in s
+	static constexpr float CoolingTime = 300.0f; // in s
+	// Blocks after a power change that are not used because the sensor lags behind the heater. After
+	// turning off the heater, the sensor takes a while to catch up with the temperature of the board
+	static constexpr uint8_t SkipBlocksHeating = 10;
+	static constexpr uint8_t SkipBlocksCooling = 60;
+
+	Identification();
+
+	void Start(float temp, float maxPower);
+	// Returns the heater power to apply while running
+	float Update(float temp, float dt);
+	State GetState() const { return state; }
+	bool IsRunning() const { return state == State::Heating || state == State::Cooling; }
+	// Only valid in the Done state
+	float GetResistance() const { return resistance; }
+	float GetCapacity() const { return capacity; }
+	float GetAmbient() const { return ambient; }
+
+	static const char* StateName(State s);
+
+private:
+	void AddBlock(float temp, float slope);
+	void Solve();
+
+	State state;
+	float power;
+	float startTemp;
+	float phaseTime;
+	float blockSum;
+	float blockTime;
+	uint16_t blockSamples;
+	float lastBlock;
+	uint16_t blocks;
+	// Sums for the fits, temperatures relative to startTemp
+	struct {
+		uint16_t n;
+		float sumT, sumY;
+	} heating;
+	struct {
+		uint16_t n;
+		float sumT, sumTT, sumY, sumTY;
+	} cooling;
+	float resistance, capacity, ambient;
+};
+
+}
+
@@ -0,0 +1,75 @@
+#include "Perf.hpp"
+
+#include "hardware/timer.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+using namespace Perf;
+
+static Stats sections[(int) Section::Last];
+
+void Stats::Add(uint32_t us) {
+	uint8_t bucket = 0;
+	uint32_t limit = FirstBucketLimit;
+	while(bucket < NumBuckets - 1 && us >= limit) {
+		bucket++;
+		limit *= 10;
+	}
+	// may be called from different tasks
+	taskENTER_CRITICAL();
+	if(count == 0 || us < min) {
+		min = us;
+	}
+	if(us > max) {
+		max = us;
+	}
+	count++;
+	sum += us;
+	buckets[bucket]++;
+	taskEXIT_CRITICAL();
+}
+
+void Stats::Reset() {
+	taskENTER_CRITICAL();
+	count = 0;
+	min = 0;
+	max = 0;
+	sum = 0;
+	for(auto &b : buckets) {
+		b = 0;
+	}
+	taskEXIT_CRITICAL();
+}
+
+const char* Perf::SectionName(Section s) {
+	switch(s) {
+	case Section::DiskRead: return "DISK_READ";
+	case Section::DiskWrite: return "DISK_WRITE";
+	case Section::FlashWaitBusy: return "FLASH_WAITBUSY";
+	default: return "INVALID";
+	}
+}
+
+const Stats& Perf::Get(Section s) {
+	return sections[(int) s];
+}
+
+uint32_t Perf::Now() {
+	return time_us_32();
+}
+
+void Perf::Record(Stats &stats, uint32_t start) {
+	// unsigned arithmetic handles the timer wrap-around
+	stats.Add(time_us_32() - start);
+}
+
+void Perf::Record(Section s, uint32_t start) {
+	Record(sections[(int) s], start);
+}
+
+void Perf::Reset() {
+	for(auto &s : sections) {
+		s.Reset();
+	}
+}
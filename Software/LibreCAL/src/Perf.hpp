@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+// Lightweight execution time statistics based on the microsecond timer
+namespace Perf {
+
+class Stats {
+public:
+	static constexpr uint8_t NumBuckets = 6;
+	// Histogram buckets are decades: <10us, <100us, <1ms, <10ms, <100ms and everything above
+	static constexpr uint32_t FirstBucketLimit = 10;
+
+	void Add(uint32_t us);
+	void Reset();
+
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+	uint32_t buckets[NumBuckets];
+};
+
+// Low level operations that are timed independently of the SCPI commands
+enum class Section : uint8_t {
+	DiskRead,
+	DiskWrite,
+	FlashWaitBusy,
+	Last,
+};
+
+const char* SectionName(Section s);
+const Stats& Get(Section s);
+
+// Timestamp for the start of a measurement
+uint32_t Now();
+// Adds the time since start (obtained with Now()) to the statistics
+void Record(Stats &stats, uint32_t start);
+void Record(Section s, uint32_t start);
+
+void Reset();
+
+}
@@ -9,11 +9,18 @@
 #include <array>
 
 #include "Heater.hpp"
+#include "Status.hpp"
 #include "Switch.hpp"
 #include "Touchstone.hpp"
+#include "Perf.hpp"
+#include "Sequence.hpp"
+#include "Siglent.hpp"
+#include "Scratch.hpp"
+#include "FileSystem.hpp"
 
 #include <pico/bootrom.h>
 #include "hardware/rtc.h"
+#include "hardware/regs/addressmap.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -24,18 +31,75 @@ constexpr int CommentMaxSize = 120;
 constexpr int ParseLastCmdMaxSize = CommentMaxSize+1;
 constexpr int ParseArgumentsMax = CommentMaxSize+1;
 
-constexpr int NumInterfaces = 2;
+// CDC, vendor and USBTMC
+constexpr int NumInterfaces = 3;
 constexpr int BufferSize = 256;
-
-static char buffer[NumInterfaces][BufferSize];
-static uint16_t rx_cnt[NumInterfaces];
+// Matches the size of the USB transmit FIFO
+constexpr int ResponseBufferSize = 256;
 
 static scpi_tx_callback tx_data;
+static scpi_tx_end_callback tx_end;
+
+// Responses are collected and handed to the transmit callback in as few calls as possible
+static uint8_t response[NumInterfaces][ResponseBufferSize];
+static uint16_t response_cnt[NumInterfaces];
+
+// Interface that enabled service requests, unsolicited service requests are sent there
+static int8_t srqInterface = -1;
+
+// Interfaces that only respond to queries (see SCPI::SetQueryResponsesOnly)
+static bool queryResponsesOnly[NumInterfaces];
+// The output of the current command is discarded (not a query on an interface that only responds to queries)
+static bool discarding[NumInterfaces];
+// The discarded output contained an error
+static bool discardedError[NumInterfaces];
 
 static char scpi_date_time_utc[] = "UTC+00:00"; // Default UTC+00:00 shall be set by SCPI :DATE_TIME
 
+static void tx_flush(uint8_t interface) {
+	if(response_cnt[interface] > 0) {
+		tx_data(response[interface], response_cnt[interface], interface);
+		response_cnt[interface] = 0;
+	}
+}
+
+// Sends the rest of a response and marks its end
+static void tx_complete(uint8_t interface) {
+	if(discarding[interface]) {
+		// no response at all, a failure is only reported through the status registers
+		if(discardedError[interface]) {
+			Status::SetEvent(Status::Event::ExecutionError);
+		}
+		discarding[interface] = false;
+		return;
+	}
+	tx_flush(interface);
+	if(tx_end) {
+		tx_end(interface);
+	}
+}
+
+static bool tx_buffered(const uint8_t *data, uint16_t len, uint8_t interface) {
+	if(discarding[interface]) {
+		if(len >= 5 && memcmp(data, "ERROR", 5) == 0) {
+			discardedError[interface] = true;
+		}
+		return true;
+	}
+	if(response_cnt[interface] + len > ResponseBufferSize) {
+		tx_flush(interface);
+		if(len > ResponseBufferSize) {
+			// too large for the buffer anyway, pass on directly
+			return tx_data(data, len, interface);
+		}
+	}
+	memcpy(&response[interface][response_cnt[interface]], data, len);
+	response_cnt[interface] += len;
+	return true;
+}
+
 static void tx_string(const char *s, uint8_t interface) {
-	tx_data((const uint8_t*) s, strlen(s), interface);
+	tx_buffered((const uint8_t*) s, strlen(s), interface);
 }
 
 static void tx_int(int i, uint8_t interface) {
@@ -153,15 +217,66 @@ static bool validate_utc(const char *utc) {
 	return true;
 }
 
+// Handler for commands with an IEEE 488.2 definite length block (#<n><length><data>) as their
+// last argument. The block data is not buffered, it is passed on as it arrives from the host.
+struct BlockHandler {
+	// Called with the arguments preceding the block, return false to reject the block
+	bool (*start)(char *argv[], int argc, uint32_t length, int interface);
+	// Called for every received chunk of block data, return false to abort
+	bool (*data)(const uint8_t *data, uint16_t len, int interface);
+	// Called after the last byte of the block has been received. Responsible for the response
+	void (*finish)(bool success, int interface);
+};
+
 class Command {
 public:
 	using Cmd = void(*)(char *argv[], int argc, int interface);
 	using Query = void(*)(char *argv[], int argc, int interface);
 
-	Command(const char *name, Cmd cmd = nullptr, Query query = nullptr, int min_args_cmd = 0, int min_args_query = 0) :
-		name(name), cmd(cmd), query(query), min_args_cmd(min_args_cmd), min_args_query(min_args_query) {}
+	Command(const char *name, Cmd cmd = nullptr, Query query = nullptr, int min_args_cmd = 0, int min_args_query = 0, const BlockHandler *block = nullptr) :
+		name(name), cmd(cmd), query(query), min_args_cmd(min_args_cmd), min_args_query(min_args_query), block(block) {}
 
 	bool parse(char *argv[], int argc, uint8_t interface) const {
+		auto i = match(argv);
+		if(i < 0) {
+			return false;
+		}
+		// got a match check cmd/query
+		if(argv[0][i] == '\0' && cmd != nullptr) {
+			if(argc - 1 < min_args_cmd) {
+				return false;
+			}
+			cmd(argv, argc, interface);
+			return true;
+		} else if(argv[0][i] == '?' && query != nullptr) {
+			if(argc - 1 < min_args_query) {
+				return false;
+			}
+			query(argv, argc, interface);
+			return true;
+		}
+		// cmd or query not available
+		return false;
+	}
+
+	// Checks whether this command accepts a block with the given (preceding) arguments
+	bool acceptsBlock(char *argv[], int argc) const {
+		if(block == nullptr) {
+			return false;
+		}
+		auto i = match(argv);
+		return i >= 0 && argv[0][i] == '\0' && argc - 1 >= min_args_cmd;
+	}
+
+	const char *name;
+	Cmd cmd;
+	Query query;
+	int min_args_cmd, min_args_query;
+	const BlockHandler *block;
+
+private:
+	// Returns the position of the first character after the command name in argv[0] or -1 if the name does not match
+	int match(char *argv[]) const {
 		if(argv[0][0] == ':') {
 			// remove possible leading colon
 			argv[0]++;
@@ -207,40 +322,33 @@ public:
 		}
 		if(!isMatch) {
 			// already found a mismatch during string comparison
-			return false;
+			return -1;
 		} else if(i + nameOffset != name_len) {
 			// strings are a match, but argv[0] was shorter than name
-			return false;
+			return -1;
 		}
-		// got a match check cmd/query
-		if(argv[0][i] == '\0' && cmd != nullptr) {
-			if(argc - 1 < min_args_cmd) {
-				return false;
-			}
-			cmd(argv, argc, interface);
-			return true;
-		} else if(argv[0][i] == '?' && query != nullptr) {
-			if(argc - 1 < min_args_query) {
-				return false;
-			}
-			query(argv, argc, interface);
-			return true;
-		}
-		// cmd or query not available
-		return false;
+		return i;
 	}
-
-	const char *name;
-	Cmd cmd;
-	Query query;
-	int min_args_cmd, min_args_query;
 };
 
 // can't be declared inside of commands as it needs the complete command list
 static void scpi_lst(char *argv[], int argc, int interface);
+static void scpi_perf(char *argv[], int argc, int interface);
+static void scpi_perf_reset(char *argv[], int argc, int interface);
+static void scpi_mem(char *argv[], int argc, int interface);
+static void scpi_tasks(char *argv[], int argc, int interface);
 
 #define ARRAY_SIZE(d) (sizeof(d)/sizeof(d[0]))
 
+// Source of port changes requested on an interface
+static Switch::Source switch_source(int interface) {
+	switch(interface) {
+	case 0: return Switch::Source::CDC;
+	case 1: return Switch::Source::Vendor;
+	default: return Switch::Source::TMC;
+	}
+}
+
 static bool arg_to_int(const char* arg, int &i)
 {
 	char *endptr;
@@ -289,6 +397,41 @@ static const char* coefficientOptionEnding(const char *option) {
 	return nullptr;
 }
 
+// Serve the coefficients for the current target temperature (see Touchstone::SelectSets)
+static bool interpolateCoefficients = true;
+
+static float coefficientTemperature() {
+	return Heater::GetTarget();
+}
+
+static char uploadFolder[50];
+static char uploadFilename[50];
+
+// Writes a coefficient file directly from the received block data
+static const BlockHandler coefficientUpload = {
+	[](char *argv[], int argc, uint32_t length, int interface) {
+		if(!coefficientOptionEnding(argv[2])) {
+			// invalid coefficient name
+			return false;
+		}
+		snprintf(uploadFolder, sizeof(uploadFolder), "%s", argv[1]);
+		snprintf(uploadFilename, sizeof(uploadFilename), "%s.%s", argv[2], coefficientOptionEnding(argv[2]));
+		return Touchstone::StartNewFile(uploadFolder, uploadFilename);
+	},
+	[](const uint8_t *data, uint16_t len, int interface) {
+		return Touchstone::WriteData(data, len);
+	},
+	[](bool success, int interface) {
+		if(!Touchstone::FinishFile() || !success) {
+			// don't leave an incomplete file behind
+			Touchstone::DeleteFile(uploadFolder, uploadFilename);
+			tx_string("ERROR\r\n", interface);
+			return;
+		}
+		tx_string("\r\n", interface);
+	},
+};
+
 static const Command commands[] = {
 		Command("*IDN", nullptr,
 		[](char *argv[], int argc, int interface){
@@ -299,6 +442,74 @@ static const Command commands[] = {
 			tx_string(resp, interface);
 		}),
 		Command("*LST", nullptr, scpi_lst),
+		Command("*CLS", [](char *argv[], int argc, int interface){
+			Status::ClearEvents();
+			tx_string("\r\n", interface);
+		}),
+		Command("*ESE", [](char *argv[], int argc, int interface){
+			int mask;
+			if(!arg_to_int(argv[1], mask) || mask < 0 || mask > 255) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			Status::SetEventEnable(mask);
+			tx_string("\r\n", interface);
+		},
+		[](char *argv[], int argc, int interface){
+			tx_int(Status::GetEventEnable(), interface);
+			tx_string("\r\n", interface);
+		}, 1),
+		Command("*ESR", nullptr, [](char *argv[], int argc, int interface){
+			tx_int(Status::ReadEvents(), interface);
+			tx_string("\r\n", interface);
+		}),
+		Command("*SRE", [](char *argv[], int argc, int interface){
+			int mask;
+			if(!arg_to_int(argv[1], mask) || mask < 0 || mask > 255) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			Status::SetServiceRequestEnable(mask);
+			srqInterface = mask ? interface : -1;
+			tx_string("\r\n", interface);
+		},
+		[](char *argv[], int argc, int interface){
+			tx_int(Status::GetServiceRequestEnable(), interface);
+			tx_string("\r\n", interface);
+		}, 1),
+		Command("*STB", nullptr, [](char *argv[], int argc, int interface){
+			tx_int(Status::GetStatusByte(), interface);
+			tx_string("\r\n", interface);
+		}),
+		Command("*OPC", [](char *argv[], int argc, int interface){
+			// operation complete event is set as soon as the heater is stable
+			Status::RequestOperationComplete();
+			tx_string("\r\n", interface);
+		},
+		[](char *argv[], int argc, int interface){
+			// blocks all interfaces until the heater is stable and the ports have settled
+			if(!Status::WaitOperationsComplete()) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			Switch::WaitSettled();
+			tx_string("1\r\n", interface);
+		}),
+		Command("*TRG", [](char *argv[], int argc, int interface){
+			if(!Sequence::Trigger()) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		}),
+		Command("*WAI", [](char *argv[], int argc, int interface){
+			if(!Status::WaitOperationsComplete()) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			Switch::WaitSettled();
+			tx_string("\r\n", interface);
+		}),
 		Command("FIRMWARE", nullptr, [](char *argv[], int argc, int interface){
 			char resp[20];
 			snprintf(resp, sizeof(resp), "%d.%d.%d\r\n", FW_MAJOR, FW_MINOR, FW_PATCH);
@@ -329,11 +540,66 @@ static const Command commands[] = {
 				tx_string("FALSE\r\n", interface);
 			}
 		}),
+		Command("TEMPerature:ETA", nullptr, [](char *argv[], int argc, int interface){
+			float eta = Heater::GetTimeToStable();
+			tx_int(eta < 0 ? -1 : eta + 0.5f, interface);
+			tx_string("\r\n", interface);
+		}),
+		Command("TEMPerature:HISTory", nullptr, [](char *argv[], int argc, int interface){
+			// optional: only return samples after this time (in seconds, as returned by a previous query)
+			uint32_t since = 0;
+			if(argc >= 2) {
+				char *end;
+				double s = strtod(argv[1], &end);
+				if(end == argv[1] || s < 0) {
+					tx_string("ERROR\r\n", interface);
+					return;
+				}
+				since = s * 1000 + 0.5;
+			}
+			static Heater::HistoryEntry entries[Heater::HistorySize];
+			auto cnt = Heater::GetHistory(entries, Heater::HistorySize, since);
+			tx_int(cnt, interface);
+			tx_string("\r\n", interface);
+			for(uint16_t i=0;i<cnt;i++) {
+				auto &e = entries[i];
+				char line[60];
+				snprintf(line, sizeof(line), "%lu.%03lu,%.2f,%.3f,%s\r\n", e.time / 1000, e.time % 1000,
+						e.temperature, e.power, e.stable ? "TRUE" : "FALSE");
+				tx_string(line, interface);
+			}
+		}),
 		Command("HEATer:POWer", nullptr, [](char *argv[], int argc, int interface){
 			char resp[20];
 			snprintf(resp, sizeof(resp), "%f\r\n", Heater::GetPower());
 			tx_string(resp, interface);
 		}),
+		Command("HEATer:TUNE", [](char *argv[], int argc, int interface){
+			if(!Heater::StartTuning()) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		},
+		[](char *argv[], int argc, int interface){
+			tx_string(HeaterControl::Identification::StateName(Heater::GetTuningState()), interface);
+			tx_string("\r\n", interface);
+		}),
+		Command("HEATer:TUNE:SAVE", [](char *argv[], int argc, int interface){
+			// the parameters are stored on the factory partition
+			if(!Touchstone::IsFactoryWritingEnabled() || !Heater::SaveParameters()) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		}),
+		Command("HEATer:MODEL", nullptr, [](char *argv[], int argc, int interface){
+			float resistance, capacity;
+			Heater::GetModel(resistance, capacity);
+			char resp[40];
+			snprintf(resp, sizeof(resp), "%f,%f\r\n", resistance, capacity);
+			tx_string(resp, interface);
+		}),
 		Command("PORT", [](char *argv[], int argc, int interface){
 			int port;
 			if(!arg_to_int(argv[1], port)) {
@@ -351,12 +617,12 @@ static const Command commands[] = {
 					if(s == Switch::Standard::Through) {
 						// also needs the destination port
 						int dest;
-						if(argc < 4 || !arg_to_int(argv[3], dest) || !Switch::SetThrough(port - 1, dest - 1)) {
+						if(argc < 4 || !arg_to_int(argv[3], dest) || !Switch::SetThrough(port - 1, dest - 1, switch_source(interface))) {
 							// either no/invalid argument or failed to set standard
 							break;
 						}
 					} else {
-						Switch::SetStandard(port - 1, s);
+						Switch::SetStandard(port - 1, s, switch_source(interface));
 					}
 					tx_string("\r\n", interface);
 					return;
@@ -384,6 +650,159 @@ static const Command commands[] = {
 			}
 			tx_string("\r\n", interface);
 		}, 2, 1),
+		Command("PORT:ALL", [](char *argv[], int argc, int interface){
+			Switch::Standard standards[Switch::NumPorts];
+			int8_t dest[Switch::NumPorts];
+			std::array<Switch::Standard, 5> available = {Switch::Standard::Open, Switch::Standard::Short, Switch::Standard::Load, Switch::Standard::Through, Switch::Standard::None};
+			int arg = 1;
+			for(uint8_t port=0;port<Switch::NumPorts;port++) {
+				if(arg >= argc) {
+					// not enough standards
+					tx_string("ERROR\r\n", interface);
+					return;
+				}
+				bool found = false;
+				for(auto s : available) {
+					if(Switch::NameMatched(argv[arg], s)) {
+						standards[port] = s;
+						found = true;
+						break;
+					}
+				}
+				if(!found) {
+					tx_string("ERROR\r\n", interface);
+					return;
+				}
+				arg++;
+				dest[port] = -1;
+				int d;
+				if(standards[port] == Switch::Standard::Through && arg < argc && arg_to_int(argv[arg], d)) {
+					// through with an explicit destination port
+					if(d < 1 || d > Switch::NumPorts) {
+						tx_string("ERROR\r\n", interface);
+						return;
+					}
+					dest[port] = d - 1;
+					arg++;
+				}
+			}
+			if(arg != argc || !Switch::SetAll(standards, dest, switch_source(interface))) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		},
+		[](char *argv[], int argc, int interface){
+			for(uint8_t port=0;port<Switch::NumPorts;port++) {
+				if(port > 0) {
+					tx_string(" ", interface);
+				}
+				auto standard = Switch::GetStandard(port);
+				tx_string(Switch::StandardName(standard), interface);
+				if(standard == Switch::Standard::Through) {
+					tx_string(" ", interface);
+					tx_int(Switch::GetThroughDestination(port) + 1, interface);
+				}
+			}
+			tx_string("\r\n", interface);
+		}, Switch::NumPorts),
+		Command("PORT:HISTory", nullptr, [](char *argv[], int argc, int interface){
+			static Switch::HistoryEntry entries[Switch::HistorySize];
+			auto cnt = Switch::GetHistory(entries, Switch::HistorySize);
+			tx_int(cnt, interface);
+			tx_string("\r\n", interface);
+			for(uint16_t i=0;i<cnt;i++) {
+				auto &e = entries[i];
+				char oldState[Switch::NumPorts + 1], newState[Switch::NumPorts + 1];
+				Switch::FormatState(e.oldState, oldState);
+				Switch::FormatState(e.newState, newState);
+				char line[60];
+				snprintf(line, sizeof(line), "%lu.%06lu,%s,%s,%s\r\n", (uint32_t) (e.time / 1000000), (uint32_t) (e.time % 1000000),
+						Switch::SourceName(e.source), oldState, newState);
+				tx_string(line, interface);
+			}
+		}),
+		Command("PORT:SETTLED", nullptr, [](char *argv[], int argc, int interface){
+			if(Switch::IsSettled()) {
+				tx_string("TRUE\r\n", interface);
+			} else {
+				tx_string("FALSE\r\n", interface);
+			}
+		}),
+		Command("PORT:WAIT", nullptr, [](char *argv[], int argc, int interface){
+			Switch::WaitSettled();
+			tx_string("1\r\n", interface);
+		}),
+		Command("PORT:SETTLE:TIME", [](char *argv[], int argc, int interface){
+			std::array<Switch::Standard, 5> standards = {Switch::Standard::Open, Switch::Standard::Short, Switch::Standard::Load, Switch::Standard::Through, Switch::Standard::None};
+			int us;
+			if(!arg_to_int(argv[2], us) || us < 0) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			for(auto s : standards) {
+				if(Switch::NameMatched(argv[1], s)) {
+					Switch::SetSettlingTime(s, us);
+					tx_string("\r\n", interface);
+					return;
+				}
+			}
+			tx_string("ERROR\r\n", interface);
+		},
+		[](char *argv[], int argc, int interface){
+			std::array<Switch::Standard, 5> standards = {Switch::Standard::Open, Switch::Standard::Short, Switch::Standard::Load, Switch::Standard::Through, Switch::Standard::None};
+			for(auto s : standards) {
+				if(Switch::NameMatched(argv[1], s)) {
+					tx_int(Switch::GetSettlingTime(s), interface);
+					tx_string("\r\n", interface);
+					return;
+				}
+			}
+			tx_string("ERROR\r\n", interface);
+		}, 2, 1),
+		Command("SEQuence:DEFine", [](char *argv[], int argc, int interface){
+			if(!Sequence::Define(argv[1], &argv[2], argc - 2)) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		}, nullptr, 2),
+		Command("SEQuence:DELete", [](char *argv[], int argc, int interface){
+			if(!Sequence::Delete(argv[1])) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		}, nullptr, 1),
+		Command("SEQuence:LIST", nullptr, [](char *argv[], int argc, int interface){
+			uint8_t i=0;
+			const char *name;
+			while((name = Sequence::GetName(i))) {
+				if(i > 0) {
+					tx_string(",", interface);
+				}
+				tx_string(name, interface);
+				i++;
+			}
+			tx_string("\r\n", interface);
+		}),
+		Command("SEQuence:STARt", [](char *argv[], int argc, int interface){
+			if(!Sequence::Start(argv[1])) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		}, nullptr, 1),
+		Command("SEQuence:STEP", nullptr, [](char *argv[], int argc, int interface){
+			tx_int(Sequence::CurrentStep(), interface);
+			tx_string(" ", interface);
+			tx_int(Sequence::NumSteps(), interface);
+			if(Switch::IsSettled()) {
+				tx_string(" TRUE\r\n", interface);
+			} else {
+				tx_string(" FALSE\r\n", interface);
+			}
+		}),
 		Command("COEFFicient:LIST", nullptr, [](char *argv[], int argc, int interface){
 			tx_string("FACTORY", interface);
 			uint8_t i=0;
@@ -453,7 +872,13 @@ static const Command commands[] = {
 		}, nullptr, 1),
 		Command("COEFFicient:ADD", [](char *argv[], int argc, int interface){
 			double freq = strtod(argv[1], NULL);
-			double values[argc - 2];
+			// AddPoint takes the lock as well, it must be taken before the checkout
+			FileSystem::Lock lock;
+			Scratch::Buffer<double> values(argc - 2);
+			if(!values) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
 			for(uint8_t i=0;i<argc - 2;i++) {
 				values[i] = strtod(argv[i+2], NULL);
 			}
@@ -482,7 +907,12 @@ static const Command commands[] = {
 			}
 			char filename[50];
 			snprintf(filename, sizeof(filename), "%s.%s", argv[2], coefficientOptionEnding(argv[2]));
-			auto points = Touchstone::GetPointNum(argv[1], filename);
+			uint32_t points;
+			if(interpolateCoefficients) {
+				points = Touchstone::GetInterpolatedPointNum(argv[1], filename, coefficientTemperature());
+			} else {
+				points = Touchstone::GetPointNum(argv[1], filename);
+			}
 			tx_int(points, interface);
 			tx_string("\r\n", interface);
 		}, 0, 2),
@@ -498,7 +928,12 @@ static const Command commands[] = {
 				// specific point requested
 				uint32_t point = strtoul(argv[3], NULL, 10);
 				double values[9];
-				int decoded = Touchstone::GetPoint(argv[1], filename, point, values);
+				int decoded;
+				if(interpolateCoefficients) {
+					decoded = Touchstone::GetInterpolatedPoint(argv[1], filename, point, values, coefficientTemperature());
+				} else {
+					decoded = Touchstone::GetPoint(argv[1], filename, point, values);
+				}
 				if(decoded == 0) {
 					tx_string("ERROR\r\n", interface);
 					return;
@@ -519,13 +954,61 @@ static const Command commands[] = {
 				}
 			} else if(argc == 3) {
 				// whole file requested
-				if(!Touchstone::PrintFile(argv[1], filename, tx_data, interface)) {
+				bool success;
+				if(interpolateCoefficients) {
+					success = Touchstone::PrintInterpolatedFile(argv[1], filename, coefficientTemperature(), tx_buffered, interface);
+				} else {
+					success = Touchstone::PrintFile(argv[1], filename, tx_buffered, interface);
+				}
+				if(!success) {
 					tx_string("ERROR\r\n", interface);
 				}
 			} else {
 				tx_string("ERROR\r\n", interface);
 			}
 		}, 0, 2),
+		Command("COEFFicient:DATA", nullptr, [](char *argv[], int argc, int interface){
+			if(!coefficientOptionEnding(argv[2])) {
+				// invalid coefficient name
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			char filename[50];
+			snprintf(filename, sizeof(filename), "%s.%s", argv[2], coefficientOptionEnding(argv[2]));
+			if(!Touchstone::PrintBlock(argv[1], filename, tx_buffered, interface)) {
+				tx_string("ERROR\r\n", interface);
+			}
+		}, 2, 2, &coefficientUpload),
+		Command("COEFFicient:TEMPerature", [](char *argv[], int argc, int interface){
+			char *end;
+			float temp = strtof(argv[2], &end);
+			if(end == argv[2] || !Touchstone::SetTemperature(argv[1], temp)) {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		}, [](char *argv[], int argc, int interface){
+			char resp[20];
+			snprintf(resp, sizeof(resp), "%f\r\n", Touchstone::GetTemperature(argv[1]));
+			tx_string(resp, interface);
+		}, 2, 1),
+		Command("COEFFicient:INTERPolation", [](char *argv[], int argc, int interface){
+			if(strcmp(argv[1], "TRUE") == 0) {
+				interpolateCoefficients = true;
+			} else if(strcmp(argv[1], "FALSE") == 0) {
+				interpolateCoefficients = false;
+			} else {
+				tx_string("ERROR\r\n", interface);
+				return;
+			}
+			tx_string("\r\n", interface);
+		}, [](char *argv[], int argc, int interface){
+			if(interpolateCoefficients) {
+				tx_string("TRUE\r\n", interface);
+			} else {
+				tx_string("FALSE\r\n", interface);
+			}
+		}, 1),
 		Command("FACTory:ENABLEWRITE", [](char *argv[], int argc, int interface){
 			if(strcmp("I_AM_SURE", argv[1]) != 0) {
 				tx_string("ERROR\r\n", interface);
@@ -541,8 +1024,29 @@ static const Command commands[] = {
 				tx_string("ERROR\r\n", interface);
 			}
 		}),
+		Command("SIGLent:SOURce", [](char *argv[], int argc, int interface){
+			bool success;
+			if(strcmp(argv[1], "NONE") == 0) {
+				success = Siglent::SetSource(nullptr);
+			} else {
+				success = Siglent::SetSource(argv[1]);
+			}
+			tx_string(success ? "\r\n" : "ERROR\r\n", interface);
+		}, [](char *argv[], int argc, int interface){
+			char set[50];
+			if(!Siglent::GetSource(set, sizeof(set))) {
+				strcpy(set, "NONE");
+			}
+			tx_string(set, interface);
+			tx_string("\r\n", interface);
+		}, 1),
+		Command("SYSTem:PERFormance", nullptr, scpi_perf),
+		Command("SYSTem:PERFormance:RESet", scpi_perf_reset),
+		Command("SYSTem:MEMory", nullptr, scpi_mem),
+		Command("SYSTem:TASKs", nullptr, scpi_tasks),
 		Command("BOOTloader", [](char *argv[], int argc, int interface){
 			tx_string("\r\n", interface);
+			tx_complete(interface);
 			vTaskDelay(100);
 			reset_usb_boot(0, 0);
 		}),
@@ -584,6 +1088,123 @@ static const Command commands[] = {
 		}, 3),
 };
 
+// Execution time of each command (same order as the command list)
+static Perf::Stats commandStats[ARRAY_SIZE(commands)];
+
+static void tx_stats(const char *name, const Perf::Stats &stats, uint8_t interface) {
+	char resp[100];
+	snprintf(resp, sizeof(resp), "%s,%lu,%lu,%lu,%lu", name, stats.count, stats.min, stats.max,
+			stats.count ? (uint32_t) (stats.sum / stats.count) : 0UL);
+	tx_string(resp, interface);
+	for(auto b : stats.buckets) {
+		snprintf(resp, sizeof(resp), ",%lu", b);
+		tx_string(resp, interface);
+	}
+	tx_string("\r\n", interface);
+}
+
+static void scpi_perf(char *argv[], int argc, int interface) {
+	// only commands that have been executed at least once are listed
+	int lines = (int) Perf::Section::Last;
+	for(auto &s : commandStats) {
+		if(s.count) {
+			lines++;
+		}
+	}
+	tx_int(lines, interface);
+	tx_string("\r\n", interface);
+	for(int i=0;i<(int) Perf::Section::Last;i++) {
+		tx_stats(Perf::SectionName((Perf::Section) i), Perf::Get((Perf::Section) i), interface);
+	}
+	for(int i=0;i<ARRAY_SIZE(commands);i++) {
+		if(commandStats[i].count) {
+			tx_stats(commands[i].name, commandStats[i], interface);
+		}
+	}
+}
+
+static void scpi_perf_reset(char *argv[], int argc, int interface) {
+	Perf::Reset();
+	for(auto &s : commandStats) {
+		s.Reset();
+	}
+	tx_string("\r\n", interface);
+}
+
+// Defined by the linker script of the Pico SDK
+extern "C" char __end__, __StackLimit, __StackBottom, __StackTop;
+
+static void tx_values(const char *name, const uint32_t *values, uint8_t num, uint8_t interface) {
+	tx_string(name, interface);
+	for(uint8_t i=0;i<num;i++) {
+		char buf[12];
+		snprintf(buf, sizeof(buf), ",%lu", (unsigned long) values[i]);
+		tx_string(buf, interface);
+	}
+	tx_string("\r\n", interface);
+}
+
+static void scpi_mem(char *argv[], int argc, int interface) {
+	TaskStatus_t tasks[16];
+	configRUN_TIME_COUNTER_TYPE total;
+	auto numTasks = uxTaskGetSystemState(tasks, ARRAY_SIZE(tasks), &total);
+	tx_int(4 + numTasks, interface);
+	tx_string("\r\n", interface);
+	// the static data includes the FreeRTOS heap, the C library heap gets the remaining RAM
+	uint32_t ram[] = {
+		(uint32_t) ((uintptr_t) &__StackTop - SRAM_BASE),
+		(uint32_t) ((uintptr_t) &__end__ - SRAM_BASE),
+		(uint32_t) (&__StackLimit - &__end__),
+	};
+	tx_values("RAM", ram, ARRAY_SIZE(ram), interface);
+	uint32_t heap[] = {
+		configTOTAL_HEAP_SIZE,
+		xPortGetFreeHeapSize(),
+		xPortGetMinimumEverFreeHeapSize(),
+	};
+	tx_values("HEAP", heap, ARRAY_SIZE(heap), interface);
+	uint32_t arena[] = {
+		Scratch::Size,
+		Scratch::GetMaxUsage(),
+	};
+	tx_values("ARENA", arena, ARRAY_SIZE(arena), interface);
+	// used by the interrupts (and main() before the scheduler starts)
+	uint32_t stack = &__StackTop - &__StackBottom;
+	tx_values("MAINSTACK", &stack, 1, interface);
+	for(UBaseType_t i=0;i<numTasks;i++) {
+		char name[configMAX_TASK_NAME_LEN + 6];
+		snprintf(name, sizeof(name), "TASK,%s", tasks[i].pcTaskName);
+		uint32_t unused = tasks[i].usStackHighWaterMark * sizeof(StackType_t);
+		tx_values(name, &unused, 1, interface);
+	}
+}
+
+static void scpi_tasks(char *argv[], int argc, int interface) {
+	TaskStatus_t tasks[16];
+	configRUN_TIME_COUNTER_TYPE total;
+	auto numTasks = uxTaskGetSystemState(tasks, ARRAY_SIZE(tasks), &total);
+	tx_int(numTasks, interface);
+	tx_string("\r\n", interface);
+	for(UBaseType_t i=0;i<numTasks;i++) {
+		const char *state;
+		switch(tasks[i].eCurrentState) {
+		case eRunning: state = "RUNNING"; break;
+		case eReady: state = "READY"; break;
+		case eBlocked: state = "BLOCKED"; break;
+		case eSuspended: state = "SUSPENDED"; break;
+		case eDeleted: state = "DELETED"; break;
+		default: state = "INVALID"; break;
+		}
+		// share of the run time since power-up in 0.1%, interrupts are counted to the interrupted task
+		uint32_t permille = total ? tasks[i].ulRunTimeCounter * 1000 / total : 0;
+		char buf[configMAX_TASK_NAME_LEN + 60];
+		snprintf(buf, sizeof(buf), "%s,%s,%lu,%lu.%lu,%llu\r\n", tasks[i].pcTaskName, state,
+				(unsigned long) tasks[i].uxCurrentPriority, (unsigned long) permille / 10,
+				(unsigned long) permille % 10, (unsigned long long) tasks[i].ulRunTimeCounter);
+		tx_string(buf, interface);
+	}
+}
+
 static void scpi_lst(char *argv[], int argc, int interface) {
 	for(int i=0;i<ARRAY_SIZE(commands);i++) {
 		auto c = commands[i];
@@ -599,10 +1220,8 @@ static void scpi_lst(char *argv[], int argc, int interface) {
 	}
 }
 
-static void parse(char *s, uint8_t interface) {
-	static char last_cmd[ParseLastCmdMaxSize] = ":";
-	// split strings into args
-	char *argv[ParseArgumentsMax];
+// Splits a line into arguments (separated by one or more spaces). Returns the number of arguments
+static int split(char *s, char *argv[]) {
 	int argc = 0;
 	argv[argc] = s;
 	while(*s) {
@@ -610,6 +1229,10 @@ static void parse(char *s, uint8_t interface) {
 			*s = '\0';
 			// found the end of an argument, check if last argument had at least one character (merge multiple spaces)
 			if(s - argv[argc] > 0) {
+				if(argc >= ParseArgumentsMax - 1) {
+					// too many arguments, ignore the rest
+					return argc;
+				}
 				argc++;
 			}
 			argv[argc] = s + 1;
@@ -619,6 +1242,14 @@ static void parse(char *s, uint8_t interface) {
 	if(s - argv[argc] > 0) {
 		argc++;
 	}
+	return argc;
+}
+
+static void parse(char *s, uint8_t interface) {
+	static char last_cmd[ParseLastCmdMaxSize] = ":";
+	// split strings into args
+	char *argv[ParseArgumentsMax];
+	int argc = split(s, argv);
 	// not required by the spec - only when using multiple commands per line (which this implementation does not support)
 //	if(argv[0][0] != ':' && argv[0][0] != '*') {
 //		// remove leave from last_cmd and append argv[0] instead
@@ -630,18 +1261,96 @@ static void parse(char *s, uint8_t interface) {
 //		argv[0] = last_cmd;
 //	}
 	for(auto i=0;i<ARRAY_SIZE(commands);i++) {
+		auto start = Perf::Now();
 		if(commands[i].parse(argv, argc, interface)) {
+			Perf::Record(commandStats[i], start);
 			strncpy(last_cmd, argv[0], sizeof(last_cmd));
 			return;
 		}
 	}
-	tx_string("ERROR\r\n", interface);
+	Status::SetEvent(Status::Event::CommandError);
+	if(!discarding[interface]) {
+		tx_string("ERROR\r\n", interface);
+	}
+}
+
+// Decides whether the output of the command in the line is sent, has to be called before the line is split
+static void startCommand(const char *line, uint8_t interface) {
+	line += strspn(line, " ");
+	auto len = strcspn(line, " ");
+	bool query = len > 0 && line[len - 1] == '?';
+	discarding[interface] = queryResponsesOnly[interface] && !query;
+	discardedError[interface] = false;
+}
+
+// Receive state of one interface. Command lines are collected in the line buffer, the data of
+// a definite length block is passed on to the command handler without buffering
+struct InputState {
+	char line[BufferSize];
+	uint16_t cnt;
+	// line did not fit into the buffer, discard everything until the line ends
+	bool overflow;
+	// position of a possible block header ('#') within the line, 0 if none
+	uint16_t blockHeader;
+	bool inBlock;
+	uint32_t blockRemaining;
+	// command receiving the block data, nullptr if the block is discarded
+	const Command *blockCommand;
+	bool blockSuccess;
+	// start time of the block transfer
+	uint32_t blockStart;
+	// the line termination after a block is optional and has to be skipped
+	bool skipTermination;
+};
+
+static InputState input[NumInterfaces];
+
+static void finishBlock(InputState &in, uint8_t interface) {
+	in.inBlock = false;
+	in.skipTermination = true;
+	if(in.blockCommand) {
+		in.blockCommand->block->finish(in.blockSuccess, interface);
+		// block commands are timed from the block header until the end of the block
+		Perf::Record(commandStats[in.blockCommand - commands], in.blockStart);
+	} else {
+		tx_string("ERROR\r\n", interface);
+	}
+	tx_complete(interface);
 }
 
-void SCPI::Init(scpi_tx_callback callback) {
+static void startBlock(InputState &in, uint32_t length, uint8_t interface) {
+	startCommand(in.line, interface);
+	char *argv[ParseArgumentsMax];
+	int argc = split(in.line, argv);
+	in.blockCommand = nullptr;
+	if(argc > 0) {
+		for(auto i=0;i<ARRAY_SIZE(commands);i++) {
+			if(commands[i].acceptsBlock(argv, argc)) {
+				if(commands[i].block->start(argv, argc, length, interface)) {
+					in.blockCommand = &commands[i];
+				}
+				break;
+			}
+		}
+	}
+	in.blockSuccess = in.blockCommand != nullptr;
+	in.blockStart = Perf::Now();
+	in.blockRemaining = length;
+	in.inBlock = true;
+	if(length == 0) {
+		finishBlock(in, interface);
+	}
+}
+
+void SCPI::Init(scpi_tx_callback callback, scpi_tx_end_callback end) {
 	tx_data = callback;
+	tx_end = end;
+	srqInterface = -1;
 	for(auto i=0;i<NumInterfaces;i++) {
-		rx_cnt[i] = 0;
+		response_cnt[i] = 0;
+		queryResponsesOnly[i] = false;
+		discarding[i] = false;
+		memset(&input[i], 0, sizeof(input[i]));
 	}
 }
 
@@ -649,40 +1358,103 @@ void SCPI::Input(const char *msg, uint16_t len, uint8_t interface) {
 	if(interface >= NumInterfaces) {
 		return;
 	}
-	auto buf = buffer[interface];
-	auto cnt = &rx_cnt[interface];
-	if(*cnt + len > BufferSize) {
-		// doesn't fit anymore
-		return;
-	}
-	memcpy(&buf[*cnt], msg, len);
-	*cnt += len;
-	// check if got a complete line
-	char *endptr = (char*) memchr(buf, '\n', *cnt);
-	while(endptr) {
-		uint8_t bytes_line = endptr - buf + 1;
-		if(bytes_line > 1) {
-			// check if previous char was '\r'
-			auto prev = endptr - 1;
-			if(*prev == '\r') {
-				*prev = 0;
+	auto &in = input[interface];
+	while(len) {
+		if(in.inBlock) {
+			// pass block data on without copying it into the line buffer
+			uint16_t chunk = len < in.blockRemaining ? len : in.blockRemaining;
+			if(in.blockSuccess) {
+				in.blockSuccess = in.blockCommand->block->data((const uint8_t*) msg, chunk, interface);
 			}
+			msg += chunk;
+			len -= chunk;
+			in.blockRemaining -= chunk;
+			if(in.blockRemaining == 0) {
+				finishBlock(in, interface);
+			}
+			continue;
 		}
-		*endptr = 0;
-
-		parse(buf, interface);
-
-		if(*cnt > bytes_line) {
-			// already got bytes afterwards, move them
-			memmove(buf, &buf[bytes_line], *cnt - bytes_line);
-			*cnt -= bytes_line;
-			// check if we have another complete line
-			endptr = (char*) memchr(buf, '\n', *cnt);
-		} else {
-			*cnt = 0;
-			// no more data
-			endptr = 0;
+		char c = *msg++;
+		len--;
+		if(in.skipTermination) {
+			if(c == '\r') {
+				continue;
+			}
+			in.skipTermination = false;
+			if(c == '\n') {
+				continue;
+			}
+		}
+		if(c == TriggerByte && in.cnt == 0 && !in.overflow) {
+			// single byte trigger at the start of a line, advances the active sequence without a response
+			Sequence::Trigger();
+			continue;
+		}
+		if(c == '\n') {
+			// got a complete line
+			if(in.cnt > 0 && in.line[in.cnt - 1] == '\r') {
+				in.cnt--;
+			}
+			in.line[in.cnt] = '\0';
+			startCommand(in.line, interface);
+			if(in.overflow) {
+				tx_string("ERROR\r\n", interface);
+			} else {
+				parse(in.line, interface);
+			}
+			// command completed, send the complete response at once
+			tx_complete(interface);
+			in.cnt = 0;
+			in.overflow = false;
+			in.blockHeader = 0;
+			continue;
+		}
+		if(in.overflow) {
+			continue;
+		} else if(in.cnt >= BufferSize - 1) {
+			// line doesn't fit anymore
+			in.overflow = true;
+			continue;
+		}
+		in.line[in.cnt++] = c;
+		if(!in.blockHeader) {
+			if(c == '#' && in.cnt > 1 && in.line[in.cnt - 2] == ' ') {
+				// an argument starts with '#', this may be a block header
+				in.blockHeader = in.cnt - 1;
+			}
+			continue;
+		}
+		// The block header consists of '#', the number of length digits and the length itself
+		auto header = &in.line[in.blockHeader];
+		uint16_t headerLen = in.cnt - in.blockHeader;
+		if(c < '0' || c > '9' || (headerLen == 2 && c == '0')) {
+			// not a block (or an indefinite length block, which is not supported)
+			in.blockHeader = 0;
+		} else if(headerLen > 2 && headerLen == 2 + header[1] - '0') {
+			// block header complete
+			in.line[in.cnt] = '\0';
+			uint32_t length = strtoul(&header[2], NULL, 10);
+			// terminate the command line before the block
+			*header = '\0';
+			in.cnt = 0;
+			in.blockHeader = 0;
+			startBlock(in, length, interface);
 		}
 	}
 }
 
+void SCPI::SetQueryResponsesOnly(uint8_t interface) {
+	if(interface < NumInterfaces) {
+		queryResponsesOnly[interface] = true;
+	}
+}
+
+void SCPI::Poll() {
+	if(Status::Update() && srqInterface >= 0 && !queryResponsesOnly[srqInterface]) {
+		// there is no dedicated service request line, notify the host with an unsolicited message
+		char resp[20];
+		snprintf(resp, sizeof(resp), "SRQ %d\r\n", Status::GetStatusByte());
+		tx_string(resp, srqInterface);
+		tx_complete(srqInterface);
+	}
+}
@@ -5,9 +5,22 @@
 namespace SCPI {
 
 using scpi_tx_callback = bool(*)(const uint8_t *msg, uint16_t len, uint8_t interface);
+// Called after the last data of a response has been passed to the tx callback
+using scpi_tx_end_callback = void(*)(uint8_t interface);
 
-void Init(scpi_tx_callback callback);
+// Evaluates the device status and sends a service request if required
+void Poll();
+
+// Advances the active sequence when received at the start of a line (outside of a binary block)
+static constexpr char TriggerByte = 0x14;
+
+void Init(scpi_tx_callback callback, scpi_tx_end_callback end = nullptr);
 
 void Input(const char *msg, uint16_t len, uint8_t interface);
 
+// Message based interfaces (USBTMC) pair every response with a query. On these interfaces, other
+// commands send no response (a failure sets the execution error event instead) and no unsolicited
+// service request lines are sent, the host reads the status byte instead
+void SetQueryResponsesOnly(uint8_t interface);
+
 }
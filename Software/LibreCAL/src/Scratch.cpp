@@ -0,0 +1,51 @@
+#include "Scratch.hpp"
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "semphr.h"
+
+#define LOG_LEVEL	LOG_LEVEL_INFO
+#define LOG_MODULE	"Scratch"
+#include "Log.h"
+
+static constexpr uint32_t Alignment = 8;
+
+static uint8_t arena[Scratch::Size] __attribute__((aligned(Alignment)));
+static uint32_t used;
+static uint32_t maxUsed;
+
+static SemaphoreHandle_t mutex;
+static StaticSemaphore_t mutexBuffer;
+
+void *Scratch::Checkout(uint32_t size) {
+	if(!mutex) {
+		taskENTER_CRITICAL();
+		if(!mutex) {
+			mutex = xSemaphoreCreateRecursiveMutexStatic(&mutexBuffer);
+		}
+		taskEXIT_CRITICAL();
+	}
+	xSemaphoreTakeRecursive(mutex, portMAX_DELAY);
+	size = (size + Alignment - 1) & ~(Alignment - 1);
+	if(size > Size - used) {
+		LOG_ERR("Unable to check out %lu bytes, %lu in use", size, used);
+		xSemaphoreGiveRecursive(mutex);
+		return nullptr;
+	}
+	void *p = &arena[used];
+	used += size;
+	if(used > maxUsed) {
+		maxUsed = used;
+	}
+	// the mutex stays taken until the buffer is returned
+	return p;
+}
+
+void Scratch::Release(void *p) {
+	used = (uint8_t*) p - arena;
+	xSemaphoreGiveRecursive(mutex);
+}
+
+uint32_t Scratch::GetMaxUsage() {
+	return maxUsed;
+}
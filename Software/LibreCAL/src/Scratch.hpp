@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+// Statically allocated arena for large transient buffers (FatFs work areas and file objects, line
+// buffers), so the tasks using them do not need large stacks. Buffers are checked out for a scope
+// and returned in reverse order. One task owns the arena at a time, other tasks wait until all its
+// buffers have been returned.
+//
+// Must not be used while holding a lock that is also taken inside of a checkout (e.g. the flash
+// mutex), otherwise two tasks could deadlock. The filesystem lock has to be taken before the
+// checkout (see FileSystem.hpp).
+namespace Scratch {
+
+static constexpr uint32_t Size = 5120;
+
+// Returns nullptr if the arena is exhausted
+void *Checkout(uint32_t size);
+// Returns the buffer and every buffer checked out after it
+void Release(void *p);
+
+// Largest amount of the arena that has been used at once
+uint32_t GetMaxUsage();
+
+// Checks out space for num objects of type T for the lifetime of the buffer object
+template<typename T>
+class Buffer {
+public:
+	explicit Buffer(uint32_t num = 1) : data((T*) Checkout(num * sizeof(T))) {}
+	~Buffer() {
+		if(data) {
+			Release(data);
+		}
+	}
+	Buffer(const Buffer&) = delete;
+	Buffer& operator=(const Buffer&) = delete;
+
+	operator T*() const {
+		return data;
+	}
+	T* operator->() const {
+		return data;
+	}
+private:
+	T *data;
+};
+
+}
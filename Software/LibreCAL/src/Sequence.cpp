@@ -0,0 +1,155 @@
+#include "Sequence.hpp"
+
+#include "Switch.hpp"
+
+#include <cstring>
+#include <cctype>
+
+struct Step {
+	Switch::Standard standards[Switch::NumPorts];
+	int8_t dest[Switch::NumPorts];
+};
+
+struct Definition {
+	char name[Sequence::MaxNameLength + 1];
+	uint8_t numSteps;
+	Step steps[Sequence::MaxSteps];
+};
+
+static Definition sequences[Sequence::MaxSequences];
+static Definition *active;
+static uint8_t step;
+
+static Definition* find(const char *name) {
+	for(auto &s : sequences) {
+		if(s.numSteps > 0 && strcmp(s.name, name) == 0) {
+			return &s;
+		}
+	}
+	return nullptr;
+}
+
+static bool parseStep(const char *token, Step &step) {
+	if(strlen(token) != Switch::NumPorts) {
+		return false;
+	}
+	for(uint8_t i=0;i<Switch::NumPorts;i++) {
+		step.dest[i] = -1;
+		switch(toupper(token[i])) {
+		case 'O': step.standards[i] = Switch::Standard::Open; break;
+		case 'S': step.standards[i] = Switch::Standard::Short; break;
+		case 'L': step.standards[i] = Switch::Standard::Load; break;
+		case 'N': step.standards[i] = Switch::Standard::None; break;
+		default: {
+			int dest = token[i] - '1';
+			// the destination port must point back to this port
+			if(dest < 0 || dest >= Switch::NumPorts || dest == i || token[dest] != '1' + i) {
+				return false;
+			}
+			step.standards[i] = Switch::Standard::Through;
+			step.dest[i] = dest;
+		}
+			break;
+		}
+	}
+	return true;
+}
+
+static void apply() {
+	auto &s = active->steps[step - 1];
+	Switch::SetAll(s.standards, s.dest, Switch::Source::Sequence);
+}
+
+bool Sequence::Define(const char *name, char *steps[], uint8_t numSteps) {
+	if(strlen(name) > MaxNameLength || numSteps == 0 || numSteps > MaxSteps) {
+		return false;
+	}
+	auto seq = find(name);
+	if(!seq) {
+		// use a free slot
+		for(auto &s : sequences) {
+			if(s.numSteps == 0) {
+				seq = &s;
+				break;
+			}
+		}
+		if(!seq) {
+			return false;
+		}
+	}
+	// parse all steps before changing anything
+	Step parsed[MaxSteps];
+	for(uint8_t i=0;i<numSteps;i++) {
+		if(!parseStep(steps[i], parsed[i])) {
+			return false;
+		}
+	}
+	if(seq == active) {
+		// redefining the active sequence stops it
+		active = nullptr;
+		step = 0;
+	}
+	strcpy(seq->name, name);
+	memcpy(seq->steps, parsed, numSteps * sizeof(Step));
+	seq->numSteps = numSteps;
+	return true;
+}
+
+bool Sequence::Delete(const char *name) {
+	auto seq = find(name);
+	if(!seq) {
+		return false;
+	}
+	if(seq == active) {
+		active = nullptr;
+		step = 0;
+	}
+	seq->numSteps = 0;
+	return true;
+}
+
+const char* Sequence::GetName(uint8_t index) {
+	// only count the used slots
+	for(auto &s : sequences) {
+		if(s.numSteps > 0) {
+			if(index == 0) {
+				return s.name;
+			}
+			index--;
+		}
+	}
+	return nullptr;
+}
+
+bool Sequence::Start(const char *name) {
+	auto seq = find(name);
+	if(!seq) {
+		return false;
+	}
+	active = seq;
+	step = 1;
+	apply();
+	return true;
+}
+
+bool Sequence::Trigger() {
+	if(!active || step >= active->numSteps) {
+		// no sequence or already at the last step
+		return false;
+	}
+	step++;
+	apply();
+	return true;
+}
+
+const char* Sequence::ActiveName() {
+	return active ? active->name : nullptr;
+}
+
+uint8_t Sequence::CurrentStep() {
+	return step;
+}
+
+uint8_t Sequence::NumSteps() {
+	return active ? active->numSteps : 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+// Stored sequences of port states that are stepped through with a trigger
+namespace Sequence {
+
+static constexpr uint8_t MaxSequences = 4;
+static constexpr uint8_t MaxSteps = 32;
+static constexpr uint8_t MaxNameLength = 20;
+
+// Defines (or replaces) a sequence. Each step is given as one character per port:
+// O (open), S (short), L (load), N (none) or the destination port number for a through
+bool Define(const char *name, char *steps[], uint8_t numSteps);
+bool Delete(const char *name);
+// Returns the name of a defined sequence or nullptr if the index is not used
+const char* GetName(uint8_t index);
+
+// Selects a sequence and applies its first step
+bool Start(const char *name);
+// Advances the active sequence by one step. Returns false if there is no further step
+bool Trigger();
+
+// Name of the active sequence, nullptr if no sequence was started
+const char* ActiveName();
+// Current step (starting at 1), 0 if no sequence was started
+uint8_t CurrentStep();
+uint8_t NumSteps();
+
+}
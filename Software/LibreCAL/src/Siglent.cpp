@@ -0,0 +1,685 @@
+#include "Siglent.hpp"
+
+#include "Touchstone.hpp"
+#include "serial.h"
+#include "Scratch.hpp"
+#include "FileSystem.hpp"
+#include "ff.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+
+#define LOG_LEVEL	LOG_LEVEL_INFO
+#define LOG_MODULE	"Siglent"
+#include "Log.h"
+
+static constexpr char sourceFile[] = "0:/siglent/source.txt";
+
+// The data contains every reflection standard of the four ports and the six throughs (which are
+// also used as the confidence check standard). These are the source files, in the order of the
+// values within a point.
+static constexpr uint8_t NumFiles = 18;
+static constexpr uint8_t NumReflectionFiles = 12;
+static constexpr const char *reflectionStandards[] = {"OPEN", "SHORT", "LOAD"};
+static constexpr const char *throughs[] = {"12", "13", "14", "23", "24", "34"};
+// frequency, real and imaginary part of the reflection standards and the four S parameters of the throughs
+static constexpr uint8_t ValuesPerPoint = 1 + NumReflectionFiles * 2 + (NumFiles - NumReflectionFiles) * 8;
+// the reflection standards get two additional values per port, the throughs are written twice
+static constexpr uint8_t ColumnsPerRow = 1 + 4 * 8 + 2 * (NumFiles - NumReflectionFiles) * 8;
+// sign, ten digits, decimal point, exponent and separator
+static constexpr uint8_t MaxValueLength = 18;
+
+// The CSV is written row by row, but each row needs values from every file. Only one file can be
+// open at a time (each file needs a sector buffer), so the points are read in groups
+static constexpr uint16_t GroupSize = 16;
+static double group[GroupSize][ValuesPerPoint];
+
+static constexpr char csvName[] = "Factory.csv";
+static constexpr uint16_t csvNameLength = sizeof(csvName) - 1;
+static constexpr uint16_t LocalHeaderSize = 30 + csvNameLength;
+static constexpr uint16_t CentralDirectorySize = 46 + csvNameLength;
+static constexpr uint16_t EndOfCentralDirectorySize = 22;
+static constexpr uint16_t InfoSize = 1024;
+
+static char source[50];
+
+// Everything about the generated data that requires reading all of it
+struct Cache {
+	bool valid;
+	uint32_t generation;
+	char set[50];
+	uint32_t points;
+	double frequencyMultiplier;
+	uint16_t date, time; // FAT format
+	double firstFrequency, lastFrequency;
+	uint32_t csvSize;
+	uint32_t crc;
+	uint8_t md5[16];
+};
+static Cache cache;
+
+enum class Part : uint8_t {
+	Done,
+	LocalHeader,
+	Comments,
+	Header,
+	Rows,
+	CentralDirectory,
+};
+
+static struct {
+	bool zip; // with the zip framing, otherwise only the CSV
+	Part part;
+	uint32_t point; // next row
+	uint32_t groupStart;
+	uint32_t offsets[NumFiles]; // position of the next point within the files
+	char buf[ColumnsPerRow * MaxValueLength]; // fits a complete row
+	uint16_t len, pos;
+} stream;
+
+static FIL file;
+
+// CRC-32 as used by zip, with a table for every four bits to save flash
+static uint32_t crc32(uint32_t crc, const uint8_t *data, uint32_t len) {
+	static const uint32_t table[16] = {
+		0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+		0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+	};
+	crc = ~crc;
+	while(len--) {
+		crc ^= *data++;
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+		crc = (crc >> 4) ^ table[crc & 0x0F];
+	}
+	return ~crc;
+}
+
+// MD5 (RFC 1321), the Siglent VNA identifies the data by this hash
+class Md5 {
+public:
+	Md5() : state{0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476}, length(0) {}
+
+	void Update(const uint8_t *data, uint32_t len) {
+		while(len--) {
+			block[length++ % 64] = *data++;
+			if(length % 64 == 0) {
+				transform();
+			}
+		}
+	}
+
+	void Final(uint8_t digest[16]) {
+		uint64_t bits = length * 8;
+		uint8_t padding = 0x80;
+		Update(&padding, 1);
+		padding = 0;
+		while(length % 64 != 56) {
+			Update(&padding, 1);
+		}
+		for(uint8_t i=0;i<8;i++) {
+			uint8_t b = bits >> (8 * i);
+			Update(&b, 1);
+		}
+		for(uint8_t i=0;i<16;i++) {
+			digest[i] = state[i / 4] >> (8 * (i % 4));
+		}
+	}
+
+private:
+	void transform() {
+		static const uint32_t K[64] = {
+			0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+			0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+			0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+			0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+			0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+			0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+			0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+			0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+		};
+		static const uint8_t S[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+		uint32_t M[16];
+		for(uint8_t i=0;i<16;i++) {
+			M[i] = block[i*4] | block[i*4+1] << 8 | block[i*4+2] << 16 | (uint32_t) block[i*4+3] << 24;
+		}
+		uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+		for(uint8_t i=0;i<64;i++) {
+			uint32_t f;
+			uint8_t g;
+			if(i < 16) {
+				f = (b & c) | (~b & d);
+				g = i;
+			} else if(i < 32) {
+				f = (d & b) | (~d & c);
+				g = (5 * i + 1) % 16;
+			} else if(i < 48) {
+				f = b ^ c ^ d;
+				g = (3 * i + 5) % 16;
+			} else {
+				f = c ^ (b | ~d);
+				g = (7 * i) % 16;
+			}
+			f += a + K[i] + M[g];
+			a = d;
+			d = c;
+			c = b;
+			uint8_t s = S[(i / 16) * 4 + i % 4];
+			b += (f << s) | (f >> (32 - s));
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+	}
+
+	uint32_t state[4];
+	uint64_t length;
+	uint8_t block[64];
+};
+
+static void put16(uint8_t *p, uint16_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static void fileName(uint8_t index, char *name, uint16_t maxlen) {
+	if(index < NumReflectionFiles) {
+		snprintf(name, maxlen, "P%d_%s.s1p", index / 3 + 1, reflectionStandards[index % 3]);
+	} else {
+		snprintf(name, maxlen, "P%s_THROUGH.s2p", throughs[index - NumReflectionFiles]);
+	}
+}
+
+// Absolute paths, the Touchstone module changes the current directory
+static void filePath(const char *set, uint8_t index, char *path, uint16_t maxlen) {
+	char name[20];
+	fileName(index, name, sizeof(name));
+	if(strcmp(set, "FACTORY") == 0) {
+		snprintf(path, maxlen, "1:/%s", name);
+	} else {
+		snprintf(path, maxlen, "0:/%s/%s", set, name);
+	}
+}
+
+static uint8_t fileValues(uint8_t index) {
+	return index < NumReflectionFiles ? 2 : 8;
+}
+
+static uint8_t fileColumn(uint8_t index) {
+	if(index < NumReflectionFiles) {
+		return 1 + index * 2;
+	} else {
+		return 1 + NumReflectionFiles * 2 + (index - NumReflectionFiles) * 8;
+	}
+}
+
+// Reads the next point from a file, returns false at the end of the file. Option lines update the multiplier
+static bool readPoint(FIL &f, double *values, uint8_t num, double *multiplier = nullptr) {
+	char line[200];
+	while(f_gets(line, sizeof(line), &f)) {
+		if(line[0] == '#') {
+			if(multiplier) {
+				if(strstr(line, "GHz") || strstr(line, "GHZ")) {
+					*multiplier = 1e9;
+				} else if(strstr(line, "MHz") || strstr(line, "MHZ")) {
+					*multiplier = 1e6;
+				} else if(strstr(line, "kHz") || strstr(line, "KHZ")) {
+					*multiplier = 1e3;
+				} else if(strstr(line, "Hz") || strstr(line, "HZ")) {
+					*multiplier = 1;
+				}
+			}
+			continue;
+		} else if(line[0] == '!') {
+			continue;
+		}
+		const char *p = line;
+		uint8_t i = 0;
+		for(;i<num;i++) {
+			char *end;
+			values[i] = strtod(p, &end);
+			if(end == p) {
+				break;
+			}
+			p = end;
+		}
+		if(i == num) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Number of points of the set (all files are truncated to the shortest one), 0 if a file is missing
+static uint32_t countPoints(const char *set, double *multiplier = nullptr) {
+	uint32_t points = UINT32_MAX;
+	for(uint8_t i=0;i<NumFiles && points;i++) {
+		char path[80];
+		filePath(set, i, path, sizeof(path));
+		if(f_open(&file, path, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+			return 0;
+		}
+		double values[9];
+		uint32_t cnt = 0;
+		while(readPoint(file, values, 1 + fileValues(i), i == 0 ? multiplier : nullptr)) {
+			cnt++;
+		}
+		f_close(&file);
+		if(cnt < points) {
+			points = cnt;
+		}
+	}
+	return points;
+}
+
+static bool loadGroup() {
+	stream.groupStart = stream.point;
+	uint32_t num = cache.points - stream.point;
+	if(num > GroupSize) {
+		num = GroupSize;
+	}
+	for(uint8_t i=0;i<NumFiles;i++) {
+		char path[80];
+		filePath(cache.set, i, path, sizeof(path));
+		if(f_open(&file, path, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+			return false;
+		}
+		bool success = f_lseek(&file, stream.offsets[i]) == FR_OK;
+		for(uint32_t j=0;j<num && success;j++) {
+			double values[9];
+			success = readPoint(file, values, 1 + fileValues(i));
+			if(i == 0) {
+				group[j][0] = values[0] * cache.frequencyMultiplier;
+			}
+			memcpy(&group[j][fileColumn(i)], &values[1], fileValues(i) * sizeof(double));
+		}
+		stream.offsets[i] = f_tell(&file);
+		f_close(&file);
+		if(!success) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Scientific notation with ten significant digits, independent of the printf implementation (which
+// may not support enough precision)
+static uint16_t formatValue(char *s, double v) {
+	char *p = s;
+	if(v < 0) {
+		*p++ = '-';
+		v = -v;
+	}
+	int exp = 0;
+	uint64_t mantissa = 0;
+	if(v > 0 && std::isfinite(v)) {
+		exp = floor(log10(v));
+		for(uint8_t i=0;i<2;i++) {
+			// scale to ten digits, the exponent may be off by one due to rounding
+			double scale = 1;
+			for(int j=abs(9 - exp);j>0;j--) {
+				scale *= 10;
+			}
+			double m = exp <= 9 ? v * scale : v / scale;
+			if(m + 0.5 >= 1e10) {
+				exp++;
+			} else if(m + 0.5 < 1e9) {
+				exp--;
+			} else {
+				mantissa = m + 0.5;
+				break;
+			}
+		}
+	}
+	char digits[10];
+	for(int8_t i=9;i>=0;i--) {
+		digits[i] = '0' + mantissa % 10;
+		mantissa /= 10;
+	}
+	*p++ = digits[0];
+	*p++ = '.';
+	memcpy(p, &digits[1], 9);
+	p += 9;
+	p += sprintf(p, "e%c%02d", exp < 0 ? '-' : '+', abs(exp));
+	return p - s;
+}
+
+static void formatRow(const double *values) {
+	char *p = stream.buf;
+	auto add = [&](double v) {
+		p += formatValue(p, v);
+		*p++ = ',';
+	};
+	add(values[0]);
+	for(uint8_t port=0;port<4;port++) {
+		for(uint8_t i=0;i<6;i++) {
+			add(values[1 + port * 6 + i]);
+		}
+		// no values for the attenuation of the Siglent eCal
+		add(0);
+		add(0);
+	}
+	// the throughs also serve as the confidence check standard
+	for(uint8_t repeat=0;repeat<2;repeat++) {
+		for(uint8_t i=1 + NumReflectionFiles*2;i<ValuesPerPoint;i++) {
+			add(values[i]);
+		}
+	}
+	// replace the last separator
+	p[-1] = '\n';
+	stream.len = p - stream.buf;
+}
+
+static void formatComments() {
+	// the device information from the factory partition, as comments
+	// not read in parallel to the coefficients, the file object can be shared
+	stream.len = 0;
+	if(f_open(&file, "1:/info.txt", FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+		return;
+	}
+	char line[100];
+	while(f_gets(line, sizeof(line), &file)) {
+		char *start = line;
+		while(*start == ' ') {
+			start++;
+		}
+		auto end = start + strlen(start);
+		while(end > start && isspace(end[-1])) {
+			end--;
+		}
+		*end = '\0';
+		stream.len += snprintf(&stream.buf[stream.len], sizeof(stream.buf) - stream.len, "! %s\n", start);
+		if(stream.len >= sizeof(stream.buf)) {
+			stream.len = sizeof(stream.buf) - 1;
+			break;
+		}
+	}
+	f_close(&file);
+}
+
+// Zip headers, the CSV is stored uncompressed with its CRC and size known in advance
+static void formatLocalHeader() {
+	auto p = (uint8_t*) stream.buf;
+	put32(&p[0], 0x04034b50);
+	put16(&p[4], 10); // version needed to extract
+	put16(&p[6], 0); // flags
+	put16(&p[8], 0); // stored
+	put16(&p[10], cache.time);
+	put16(&p[12], cache.date);
+	put32(&p[14], cache.crc);
+	put32(&p[18], cache.csvSize);
+	put32(&p[22], cache.csvSize);
+	put16(&p[26], csvNameLength);
+	put16(&p[28], 0); // no extra field
+	memcpy(&p[30], csvName, csvNameLength);
+	stream.len = LocalHeaderSize;
+}
+
+static void formatCentralDirectory() {
+	auto p = (uint8_t*) stream.buf;
+	put32(&p[0], 0x02014b50);
+	put16(&p[4], 20); // version made by
+	put16(&p[6], 10); // version needed to extract
+	put16(&p[8], 0); // flags
+	put16(&p[10], 0); // stored
+	put16(&p[12], cache.time);
+	put16(&p[14], cache.date);
+	put32(&p[16], cache.crc);
+	put32(&p[20], cache.csvSize);
+	put32(&p[24], cache.csvSize);
+	put16(&p[28], csvNameLength);
+	memset(&p[30], 0, 16); // no extra field or comment, disk 0, no attributes, local header at offset 0
+	memcpy(&p[46], csvName, csvNameLength);
+	p += CentralDirectorySize;
+	put32(&p[0], 0x06054b50);
+	put16(&p[4], 0); // this disk
+	put16(&p[6], 0); // disk with the central directory
+	put16(&p[8], 1); // entries on this disk
+	put16(&p[10], 1); // entries
+	put32(&p[12], CentralDirectorySize);
+	put32(&p[16], LocalHeaderSize + cache.csvSize);
+	put16(&p[20], 0); // no comment
+	stream.len = CentralDirectorySize + EndOfCentralDirectorySize;
+}
+
+static void formatInfo() {
+	memset(stream.buf, 0, InfoSize);
+	// binary header: vendor, product and serial, followed by the (probable) number of ports
+	memcpy(&stream.buf[30], "LibreVNA", 8);
+	memcpy(&stream.buf[46], "LibreCAL", 8);
+	auto serial = getSerial();
+	memcpy(&stream.buf[62], serial, strlen(serial) < 16 ? strlen(serial) : 16);
+	stream.buf[78] = 4;
+	stream.buf[79] = 0;
+	char hash[33];
+	for(uint8_t i=0;i<16;i++) {
+		sprintf(&hash[i*2], "%02x", cache.md5[i]);
+	}
+	// invalid dates (no real time clock when the file was written) are replaced with the earliest FAT date
+	unsigned int month = (cache.date >> 5) & 0x0F;
+	unsigned int day = cache.date & 0x1F;
+	snprintf(&stream.buf[144], InfoSize - 144,
+			"Connector:SMA\n"
+			"Module:Factory\n"
+			"Desc:%s\n"
+			"Frequency:%llu,%llu,%lu\n"
+			"Data:0,%lu,%s\n"
+			"Date:%04u-%02u-%02u\n",
+			hash, (unsigned long long) cache.firstFrequency, (unsigned long long) cache.lastFrequency,
+			(unsigned long) cache.points, (unsigned long) (LocalHeaderSize + cache.csvSize
+					+ CentralDirectorySize + EndOfCentralDirectorySize), hash,
+			1980 + (cache.date >> 9), month ? month : 1, day ? day : 1);
+	stream.len = InfoSize;
+}
+
+// Generates the next part of the stream into the buffer, returns false at the end
+static bool produce() {
+	stream.pos = 0;
+	stream.len = 0;
+	while(stream.len == 0) {
+		switch(stream.part) {
+		case Part::Done:
+			return false;
+		case Part::LocalHeader:
+			formatLocalHeader();
+			stream.part = Part::Comments;
+			break;
+		case Part::Comments:
+			formatComments();
+			stream.part = Part::Header;
+			break;
+		case Part::Header:
+			stream.len = sprintf(stream.buf, "#HZ,A,B,C,D,T_AB,T_AC,T_AD,T_BC,T_BD,T_CD,CF_AB,CF_AC,CF_AD,CF_BC,CF_BD,CF_CD\n");
+			stream.part = Part::Rows;
+			break;
+		case Part::Rows:
+			if(stream.point >= cache.points) {
+				stream.part = stream.zip ? Part::CentralDirectory : Part::Done;
+				break;
+			}
+			if(stream.point == 0 || stream.point - stream.groupStart >= GroupSize) {
+				if(!loadGroup()) {
+					LOG_ERR("Failed to read coefficients");
+					stream.part = Part::Done;
+					return false;
+				}
+			}
+			formatRow(group[stream.point - stream.groupStart]);
+			stream.point++;
+			break;
+		case Part::CentralDirectory:
+			formatCentralDirectory();
+			stream.part = Part::Done;
+			break;
+		}
+	}
+	return true;
+}
+
+static void startStream(bool zip) {
+	stream.zip = zip;
+	stream.part = zip ? Part::LocalHeader : Part::Comments;
+	stream.point = 0;
+	stream.groupStart = 0;
+	memset(stream.offsets, 0, sizeof(stream.offsets));
+	stream.len = 0;
+	stream.pos = 0;
+}
+
+void Siglent::Init() {
+	FileSystem::Lock lock;
+	source[0] = '\0';
+	Scratch::Buffer<FIL> f;
+	if(!f || f_open(f, sourceFile, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+		return;
+	}
+	if(f_gets(source, sizeof(source), f)) {
+		source[strcspn(source, "\r\n")] = '\0';
+	}
+	f_close(f);
+}
+
+bool Siglent::SetSource(const char *set) {
+	FileSystem::Lock lock;
+	if(!set) {
+		source[0] = '\0';
+		auto res = f_unlink(sourceFile);
+		return res == FR_OK || res == FR_NO_FILE;
+	}
+	if(strlen(set) >= sizeof(source)) {
+		return false;
+	}
+	for(uint8_t i=0;i<NumFiles;i++) {
+		char name[20];
+		fileName(i, name, sizeof(name));
+		if(Touchstone::GetPointNum(set, name) == 0) {
+			// not a complete set
+			return false;
+		}
+	}
+	f_mkdir("0:/siglent");
+	Scratch::Buffer<FIL> f;
+	if(!f || f_open(f, sourceFile, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+		return false;
+	}
+	bool success = f_printf(f, "%s\r\n", set) > 0;
+	if(f_close(f) != FR_OK || !success) {
+		return false;
+	}
+	strcpy(source, set);
+	return true;
+}
+
+bool Siglent::GetSource(char *set, uint16_t maxlen) {
+	FileSystem::Lock lock;
+	if(!IsEnabled()) {
+		return false;
+	}
+	snprintf(set, maxlen, "%s", source);
+	return true;
+}
+
+bool Siglent::IsEnabled() {
+	return source[0] != '\0';
+}
+
+bool Siglent::Update() {
+	// the coefficients must not change while the data is generated
+	FileSystem::Lock lock;
+	uint32_t generation = Touchstone::GetGeneration();
+	if(!IsEnabled() || (cache.valid && cache.generation == generation && strcmp(cache.set, source) == 0)) {
+		return cache.valid;
+	}
+	if(Touchstone::IsWriting()) {
+		// a coefficient is incomplete until it is finished
+		return false;
+	}
+	LOG_INFO("Generating data from %s", source);
+	// a file opened before ends here
+	stream.part = Part::Done;
+	stream.len = stream.pos = 0;
+	cache.valid = false;
+	cache.generation = generation;
+	strcpy(cache.set, source);
+	cache.frequencyMultiplier = 1e9;
+	cache.points = countPoints(cache.set, &cache.frequencyMultiplier);
+	if(cache.points == 0) {
+		LOG_ERR("Set %s is incomplete", cache.set);
+		return false;
+	}
+	char path[80];
+	FILINFO info;
+	filePath(cache.set, 0, path, sizeof(path));
+	if(f_stat(path, &info) == FR_OK) {
+		cache.date = info.fdate;
+		cache.time = info.ftime;
+	} else {
+		cache.date = cache.time = 0;
+	}
+	// the CRC is part of the zip headers, the CSV has to be generated once before the zip can be hashed
+	cache.csvSize = 0;
+	cache.crc = 0;
+	startStream(false);
+	while(produce()) {
+		if(stream.point == 1) {
+			cache.firstFrequency = group[0][0];
+		}
+		if(stream.point > 0) {
+			cache.lastFrequency = group[stream.point - 1 - stream.groupStart][0];
+		}
+		cache.crc = crc32(cache.crc, (const uint8_t*) stream.buf, stream.len);
+		cache.csvSize += stream.len;
+	}
+	if(stream.point != cache.points) {
+		return false;
+	}
+	Md5 md5;
+	startStream(true);
+	while(produce()) {
+		md5.Update((const uint8_t*) stream.buf, stream.len);
+	}
+	md5.Final(cache.md5);
+	cache.valid = stream.point == cache.points;
+	return cache.valid;
+}
+
+int32_t Siglent::Open(File f) {
+	FileSystem::Lock lock;
+	if(!Update()) {
+		return -1;
+	}
+	if(f == File::Info) {
+		formatInfo();
+		stream.part = Part::Done;
+		stream.pos = 0;
+		return InfoSize;
+	}
+	startStream(true);
+	return LocalHeaderSize + cache.csvSize + CentralDirectorySize + EndOfCentralDirectorySize;
+}
+
+uint32_t Siglent::Read(uint8_t *data, uint32_t len) {
+	FileSystem::Lock lock;
+	uint32_t cnt = 0;
+	while(cnt < len) {
+		if(stream.pos >= stream.len && !produce()) {
+			break;
+		}
+		uint32_t n = stream.len - stream.pos;
+		if(n > len - cnt) {
+			n = len - cnt;
+		}
+		memcpy(&data[cnt], &stream.buf[stream.pos], n);
+		stream.pos += n;
+		cnt += n;
+	}
+	return cnt;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+// Generates the data of the Siglent eCal emulation (info.dat and data0.zip) on the fly from a
+// coefficient set, no conversion on a PC and no second copy of the coefficients is required.
+// The zip contains Factory.csv uncompressed, its size and hashes only depend on the coefficients.
+// They are calculated once and kept until a coefficient is written. All functions take the
+// filesystem lock, they can be called from any task.
+namespace Siglent {
+
+// Loads the configured coefficient set
+void Init();
+
+// Sets the coefficient set the data is generated from (nullptr to disable the generation). The set
+// must contain all coefficients of a four port LibreCAL. Stored in the flash, the Siglent emulation
+// mode is entered on the next power-up.
+bool SetSource(const char *set);
+// Returns false if the generation is disabled
+bool GetSource(char *set, uint16_t maxlen);
+bool IsEnabled();
+
+// Recalculates the size and hashes of the generated data if the coefficients have changed. This
+// takes a few seconds (blocking other file accesses), a file opened with Open can not be read
+// anymore afterwards. Fails while a coefficient is being written
+bool Update();
+
+enum class File : uint8_t {
+	Info,
+	Data,
+};
+
+// Opens a generated file for reading. Returns its size or -1 if the data can not be generated
+int32_t Open(File f);
+// Reads the next part of the opened file, returns the number of bytes read (0 at the end)
+uint32_t Read(uint8_t *data, uint32_t len);
+
+}
@@ -0,0 +1,119 @@
+#include "Status.hpp"
+
+#include "FreeRTOS.h"
+#include "event_groups.h"
+
+static EventGroupHandle_t conditions;
+static Status::NotifyCallback notify;
+
+static uint8_t events;
+static uint8_t eventEnable;
+static uint8_t serviceRequestEnable;
+static bool operationCompleteRequested;
+static bool serviceRequested;
+
+// all conditions that have to be active before pending operations are complete
+static constexpr EventBits_t OperationCompleteConditions = (EventBits_t) Status::Condition::TemperatureStable;
+
+void Status::Init(NotifyCallback callback) {
+	notify = callback;
+	conditions = xEventGroupCreate();
+	events = (uint8_t) Event::PowerOn;
+	eventEnable = 0;
+	serviceRequestEnable = 0;
+	operationCompleteRequested = false;
+	serviceRequested = false;
+}
+
+void Status::SetCondition(Condition c, bool active) {
+	auto bits = xEventGroupGetBits(conditions);
+	if(((bits & (EventBits_t) c) != 0) == active) {
+		// no change
+		return;
+	}
+	if(active) {
+		xEventGroupSetBits(conditions, (EventBits_t) c);
+	} else {
+		xEventGroupClearBits(conditions, (EventBits_t) c);
+	}
+	if(notify) {
+		notify();
+	}
+}
+
+bool Status::GetCondition(Condition c) {
+	return xEventGroupGetBits(conditions) & (EventBits_t) c;
+}
+
+void Status::SetEvent(Event e) {
+	events |= (uint8_t) e;
+}
+
+uint8_t Status::ReadEvents() {
+	auto ret = events;
+	events = 0;
+	return ret;
+}
+
+void Status::ClearEvents() {
+	events = 0;
+	operationCompleteRequested = false;
+}
+
+void Status::SetEventEnable(uint8_t mask) {
+	eventEnable = mask;
+}
+
+uint8_t Status::GetEventEnable() {
+	return eventEnable;
+}
+
+void Status::SetServiceRequestEnable(uint8_t mask) {
+	// the RQS bit can not be enabled
+	serviceRequestEnable = mask & ~RequestServiceBit;
+}
+
+uint8_t Status::GetServiceRequestEnable() {
+	return serviceRequestEnable;
+}
+
+uint8_t Status::GetStatusByte() {
+	uint8_t stb = xEventGroupGetBits(conditions) & 0x0F;
+	if(events & eventEnable) {
+		stb |= EventSummaryBit;
+	}
+	if(stb & serviceRequestEnable) {
+		stb |= RequestServiceBit;
+	}
+	return stb;
+}
+
+bool Status::OperationsComplete() {
+	return (xEventGroupGetBits(conditions) & OperationCompleteConditions) == OperationCompleteConditions;
+}
+
+bool Status::WaitOperationsComplete() {
+	auto bits = xEventGroupWaitBits(conditions, OperationCompleteConditions, pdFALSE, pdTRUE,
+			pdMS_TO_TICKS(OperationTimeoutMs));
+	if((bits & OperationCompleteConditions) != OperationCompleteConditions) {
+		SetEvent(Event::ExecutionError);
+		return false;
+	}
+	return true;
+}
+
+void Status::RequestOperationComplete() {
+	operationCompleteRequested = true;
+}
+
+bool Status::Update() {
+	if(operationCompleteRequested && OperationsComplete()) {
+		operationCompleteRequested = false;
+		SetEvent(Event::OperationComplete);
+	}
+	// service requests are only raised on the transition
+	bool request = GetStatusByte() & RequestServiceBit;
+	bool raised = request && !serviceRequested;
+	serviceRequested = request;
+	return raised;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+
+// IEEE 488.2 status reporting (status byte, standard event status register and
+// the corresponding enable registers) and tracking of pending operations
+namespace Status {
+
+// Device specific bits of the status byte, these reflect the current state of the device
+enum class Condition : uint8_t {
+	TemperatureStable = 0x01,
+};
+
+// Bits of the standard event status register
+enum class Event : uint8_t {
+	OperationComplete = 0x01,
+	ExecutionError = 0x10,
+	CommandError = 0x20,
+	PowerOn = 0x80,
+};
+
+// Status byte summary bits
+static constexpr uint8_t EventSummaryBit = 0x20;
+static constexpr uint8_t RequestServiceBit = 0x40;
+
+// Called whenever a condition changed, may be called from any task
+using NotifyCallback = void(*)();
+
+void Init(NotifyCallback callback);
+
+void SetCondition(Condition c, bool active);
+bool GetCondition(Condition c);
+
+void SetEvent(Event e);
+// Returns the standard event status register and clears it
+uint8_t ReadEvents();
+void ClearEvents();
+
+void SetEventEnable(uint8_t mask);
+uint8_t GetEventEnable();
+void SetServiceRequestEnable(uint8_t mask);
+uint8_t GetServiceRequestEnable();
+
+uint8_t GetStatusByte();
+
+// Pending operations: the heater has not reached a stable temperature yet
+bool OperationsComplete();
+// Blocks every interface while waiting, so the wait is limited (e.g. the heater can not reach a target
+// below the ambient temperature). Sets the execution error event and returns false on a timeout
+static constexpr uint32_t OperationTimeoutMs = 60000;
+bool WaitOperationsComplete();
+// Sets the operation complete event once all pending operations are complete
+void RequestOperationComplete();
+
+// Evaluates pending requests, returns true if a new service request has been raised
+bool Update();
+
+}
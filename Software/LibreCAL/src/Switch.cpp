@@ -2,6 +2,9 @@
 
 #include "pico/stdlib.h"
 
+#include "FreeRTOS.h"
+#include "task.h"
+
 #include <cstring>
 
 using namespace Switch;
@@ -43,37 +46,145 @@ static bool throughMap[4][4][3] = {
 		},
 };
 
-static void UpdatePins() {
-	uint8_t through = 0x00;
+// All control lines, used to update every port with a single write
+static uint32_t pinMask;
+static uint32_t pinState;
+
+// Time after a change of the control lines until a port has settled, depending on the new standard.
+// The control lines of the PE426462 switches are filtered by 47k series resistors and 22nF feedthrough
+// capacitors (see PortSwitch.kicad_sch), a time constant of about 1ms. The switches themselves are much
+// faster. After 5 time constants the lines are within 1% of their final level, regardless of the exact
+// logic thresholds of the switches
+static uint32_t settlingTime[(int) Standard::None + 1] = {
+		5000,	// Open
+		5000,	// Short
+		5000,	// Load
+		5000,	// Through
+		5000,	// None
+};
+// Time (from time_us_64) at which all ports are settled
+static uint64_t settledTime;
+
+static uint32_t PortMask(uint8_t port) {
+	return (1UL << VxPins[port][0]) | (1UL << VxPins[port][1]) | (1UL << VxPins[port][2]);
+}
+
+static void SetPins(uint32_t &value, uint8_t port, bool v0, bool v1, bool v2) {
+	value |= (uint32_t) v0 << VxPins[port][0];
+	value |= (uint32_t) v1 << VxPins[port][1];
+	value |= (uint32_t) v2 << VxPins[port][2];
+}
+
+// Changes are recorded without a lock: a writer only claims its slot with interrupts disabled
+// (the Cortex-M0+ has no atomic read-modify-write) and publishes the entry with its sequence number
+struct HistoryRecord {
+	volatile uint32_t seq;
+	HistoryEntry entry;
+};
+
+static HistoryRecord history[Switch::HistorySize];
+static uint32_t historyCount;
+static uint16_t currentState;
+
+// Encodes the state of all ports with 4 bits per port: the standard or 8 + destination for a through
+static uint16_t EncodeState() {
+	uint16_t state = 0;
+	for(uint8_t i=0;i<Switch::NumPorts;i++) {
+		uint16_t p = portStandards[i] == Standard::Through ? 8 + throughDestinations[i] : (uint16_t) portStandards[i];
+		state |= p << (4 * i);
+	}
+	return state;
+}
+
+static void AddHistory(Source source, uint16_t oldState, uint16_t newState) {
+	taskENTER_CRITICAL();
+	uint32_t n = historyCount++;
+	taskEXIT_CRITICAL();
+	auto &r = history[n % Switch::HistorySize];
+	// invalidate the slot while it is written
+	r.seq = 0;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	r.entry.time = time_us_64();
+	r.entry.source = source;
+	r.entry.oldState = oldState;
+	r.entry.newState = newState;
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	r.seq = n + 1;
+}
+
+static void UpdatePins(Source source = Source::Internal) {
+	// Collect the state of all ports first and apply it at once. This avoids intermediate
+	// states and all control lines change at the same time
+	uint32_t value = 0;
 	for(uint8_t i=0;i<Switch::NumPorts;i++) {
 		switch(portStandards[i]) {
 		case Standard::Open:
-			gpio_put(VxPins[i][0], 0);
-			gpio_put(VxPins[i][1], 0);
-			gpio_put(VxPins[i][2], 0);
+			SetPins(value, i, 0, 0, 0);
 			break;
 		case Standard::Short:
-			gpio_put(VxPins[i][0], 1);
-			gpio_put(VxPins[i][1], 0);
-			gpio_put(VxPins[i][2], 0);
+			SetPins(value, i, 1, 0, 0);
 			break;
 		case Standard::Load:
-			gpio_put(VxPins[i][0], 1);
-			gpio_put(VxPins[i][1], 0);
-			gpio_put(VxPins[i][2], 1);
+			SetPins(value, i, 1, 0, 1);
 			break;
 		case Standard::Through:
-			gpio_put(VxPins[i][0], throughMap[i][throughDestinations[i]][0]);
-			gpio_put(VxPins[i][1], throughMap[i][throughDestinations[i]][1]);
-			gpio_put(VxPins[i][2], throughMap[i][throughDestinations[i]][2]);
+			SetPins(value, i, throughMap[i][throughDestinations[i]][0],
+					throughMap[i][throughDestinations[i]][1],
+					throughMap[i][throughDestinations[i]][2]);
 			break;
 		case Standard::None:
-			gpio_put(VxPins[i][0], 1);
-			gpio_put(VxPins[i][1], 1);
-			gpio_put(VxPins[i][2], 0);
+			SetPins(value, i, 1, 1, 0);
 			break;
 		}
 	}
+	gpio_put_masked(pinMask, value);
+
+	// Only ports with changed control lines have to settle again. A port that is still
+	// settling from a previous change keeps its settled time
+	auto now = time_us_64();
+	for(uint8_t i=0;i<Switch::NumPorts;i++) {
+		if((value ^ pinState) & PortMask(i)) {
+			auto settled = now + settlingTime[(int) portStandards[i]];
+			if(settled > settledTime) {
+				settledTime = settled;
+			}
+		}
+	}
+	pinState = value;
+
+	auto state = EncodeState();
+	if(state != currentState) {
+		AddHistory(source, currentState, state);
+		currentState = state;
+	}
+}
+
+// Changes the standard of a port without updating the pins
+static void ChangeStandard(uint8_t port, Standard s) {
+	if(portStandards[port] == Standard::Through) {
+		// also reset the destination port
+		portStandards[throughDestinations[port]] = Standard::None;
+		throughDestinations[throughDestinations[port]] = 0;
+		throughDestinations[port] = 0;
+	}
+	portStandards[port] = s;
+	if(s == Standard::Through) {
+		// set the destination to itself (invalid)
+		throughDestinations[port] = port;
+		// check if there is any other invalid port and connect these
+		for(uint8_t i=0;i<Switch::NumPorts;i++) {
+			if(i==port) {
+				// skip this
+				continue;
+			}
+			if(portStandards[i] == Standard::Through && throughDestinations[i] == i) {
+				// connect this with port
+				throughDestinations[port] = i;
+				throughDestinations[i] = port;
+				break;
+			}
+		}
+	}
 }
 
 void Switch::Init() {
@@ -81,40 +192,22 @@ void Switch::Init() {
 		portStandards[i] = Standard::None;
 		throughDestinations[i] = 0;
 		for(uint8_t j=0;j<3;j++) {
-			gpio_init(VxPins[i][j]);
-			gpio_set_dir(VxPins[i][j], GPIO_OUT);
+			pinMask |= 1UL << VxPins[i][j];
 		}
 	}
+	gpio_init_mask(pinMask);
+	gpio_set_dir_out_masked(pinMask);
+	pinState = 0;
+	settledTime = 0;
+	historyCount = 0;
+	currentState = EncodeState();
 	UpdatePins();
 }
 
-void Switch::SetStandard(uint8_t port, Standard s) {
+void Switch::SetStandard(uint8_t port, Standard s, Source source) {
 	if(port < Switch::NumPorts) {
-		if(portStandards[port] == Standard::Through) {
-			// also reset the destination port
-			portStandards[throughDestinations[port]] = Standard::None;
-			throughDestinations[throughDestinations[port]] = 0;
-			throughDestinations[port] = 0;
-		}
-		portStandards[port] = s;
-		if(s == Standard::Through) {
-			// set the destination to itself (invalid)
-			throughDestinations[port] = port;
-			// check if there is any other invalid port and connect these
-			for(uint8_t i=0;i<Switch::NumPorts;i++) {
-				if(i==port) {
-					// skip this
-					continue;
-				}
-				if(portStandards[i] == Standard::Through && throughDestinations[i] == i) {
-					// connect this with port
-					throughDestinations[port] = i;
-					throughDestinations[i] = port;
-					break;
-				}
-			}
-		}
-		UpdatePins();
+		ChangeStandard(port, s);
+		UpdatePins(source);
 	}
 }
 
@@ -142,7 +235,7 @@ bool Switch::NameMatched(const char *name, Standard s) {
 	return strcmp(name, compare) == 0;
 }
 
-bool Switch::SetThrough(uint8_t port, uint8_t dest) {
+bool Switch::SetThrough(uint8_t port, uint8_t dest, Source source) {
 	if(port == dest) {
 		// can't set a through to itself
 		return false;
@@ -152,13 +245,60 @@ bool Switch::SetThrough(uint8_t port, uint8_t dest) {
 		return false;
 	}
 	// Reset first, this also takes care of the destination port if this port was set to through
-	SetStandard(port, Standard::None);
-	SetStandard(dest, Standard::None);
+	ChangeStandard(port, Standard::None);
+	ChangeStandard(dest, Standard::None);
 	portStandards[port] = Standard::Through;
 	portStandards[dest] = Standard::Through;
 	throughDestinations[port] = dest;
 	throughDestinations[dest] = port;
-	UpdatePins();
+	UpdatePins(source);
+	return true;
+}
+
+bool Switch::SetAll(const Standard standards[NumPorts], const int8_t dest[NumPorts], Source source) {
+	int8_t newDest[Switch::NumPorts];
+	for(uint8_t i=0;i<Switch::NumPorts;i++) {
+		newDest[i] = -1;
+	}
+	// connect the throughs with a given destination first
+	for(uint8_t i=0;i<Switch::NumPorts;i++) {
+		if(standards[i] != Standard::Through || dest[i] < 0) {
+			continue;
+		}
+		auto d = dest[i];
+		if(d >= Switch::NumPorts || d == i || standards[d] != Standard::Through) {
+			// the destination must be a different port that is also set to through
+			return false;
+		}
+		if((newDest[i] >= 0 && newDest[i] != d) || (newDest[d] >= 0 && newDest[d] != i)) {
+			// conflicting destinations
+			return false;
+		}
+		newDest[i] = d;
+		newDest[d] = i;
+	}
+	// connect the remaining throughs in the order of their port numbers
+	for(uint8_t i=0;i<Switch::NumPorts;i++) {
+		if(standards[i] != Standard::Through || newDest[i] >= 0) {
+			continue;
+		}
+		for(uint8_t j=i+1;j<Switch::NumPorts;j++) {
+			if(standards[j] == Standard::Through && newDest[j] < 0) {
+				newDest[i] = j;
+				newDest[j] = i;
+				break;
+			}
+		}
+		if(newDest[i] < 0) {
+			// no port left to connect with
+			return false;
+		}
+	}
+	for(uint8_t i=0;i<Switch::NumPorts;i++) {
+		portStandards[i] = standards[i];
+		throughDestinations[i] = standards[i] == Standard::Through ? newDest[i] : 0;
+	}
+	UpdatePins(source);
 	return true;
 }
 
@@ -168,3 +308,82 @@ uint8_t Switch::GetThroughDestination(uint8_t port) {
 	}
 	return 0;
 }
+
+void Switch::SetSettlingTime(Standard s, uint32_t us) {
+	settlingTime[(int) s] = us;
+}
+
+uint32_t Switch::GetSettlingTime(Standard s) {
+	return settlingTime[(int) s];
+}
+
+bool Switch::IsSettled() {
+	return time_us_64() >= settledTime;
+}
+
+void Switch::WaitSettled() {
+	auto now = time_us_64();
+	if(now >= settledTime) {
+		return;
+	}
+	auto remaining = settledTime - now;
+	if(remaining > 2000) {
+		// long settling time, let other tasks run during most of it
+		vTaskDelay(remaining / 1000 - 1);
+		now = time_us_64();
+		if(now >= settledTime) {
+			return;
+		}
+		remaining = settledTime - now;
+	}
+	busy_wait_us_32(remaining);
+}
+
+uint16_t Switch::GetHistory(HistoryEntry *entries, uint16_t maxEntries) {
+	uint32_t end = historyCount;
+	uint32_t start = end > HistorySize ? end - HistorySize : 0;
+	if(end - start > maxEntries) {
+		start = end - maxEntries;
+	}
+	uint16_t cnt = 0;
+	for(uint32_t n=start;n<end;n++) {
+		auto &r = history[n % HistorySize];
+		if(r.seq != n + 1) {
+			// still being written or already overwritten
+			continue;
+		}
+		entries[cnt] = r.entry;
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+		if(r.seq != n + 1) {
+			// overwritten while copying
+			continue;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+
+void Switch::FormatState(uint16_t state, char *s) {
+	for(uint8_t i=0;i<NumPorts;i++) {
+		uint8_t p = (state >> (4 * i)) & 0x0F;
+		if(p >= 8) {
+			s[i] = '1' + p - 8;
+		} else {
+			s[i] = StandardName((Standard) p)[0];
+		}
+	}
+	s[NumPorts] = '\0';
+}
+
+const char* Switch::SourceName(Source s) {
+	switch(s) {
+	case Source::CDC: return "CDC";
+	case Source::Vendor: return "VENDOR";
+	case Source::Button: return "BUTTON";
+	case Source::Sequence: return "SEQUENCE";
+	case Source::TMC: return "TMC";
+	case Source::Internal:
+	default:
+		return "INTERNAL";
+	}
+}
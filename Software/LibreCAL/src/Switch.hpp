@@ -22,12 +22,49 @@ enum class Standard {
 	None,
 };
 
+// Origin of a change, recorded in the history
+enum class Source : uint8_t {
+	Internal,
+	CDC,
+	Vendor,
+	Button,
+	Sequence,
+	TMC,
+};
+
+struct HistoryEntry {
+	uint64_t time; // in microseconds since power-up
+	Source source;
+	// states of all ports, see FormatState
+	uint16_t oldState;
+	uint16_t newState;
+};
+
+static constexpr uint16_t HistorySize = 128;
+
 void Init();
-void SetStandard(uint8_t port, Standard s);
-bool SetThrough(uint8_t port, uint8_t dest);
+void SetStandard(uint8_t port, Standard s, Source source = Source::Internal);
+bool SetThrough(uint8_t port, uint8_t dest, Source source = Source::Internal);
+// Sets all ports at once. A negative destination connects a through with the next unconnected through port.
+// Returns false (and leaves the ports unchanged) if the combination is invalid
+bool SetAll(const Standard standards[NumPorts], const int8_t dest[NumPorts], Source source = Source::Internal);
 Standard GetStandard(uint8_t port);
 uint8_t GetThroughDestination(uint8_t port);
 
+// Settling time (in microseconds) after switching a port to a standard
+void SetSettlingTime(Standard s, uint32_t us);
+uint32_t GetSettlingTime(Standard s);
+// Checks whether all ports have settled after the last change
+bool IsSettled();
+// Blocks until all ports have settled
+void WaitSettled();
+
+// Copies the recorded changes (oldest first) and returns the number of entries
+uint16_t GetHistory(HistoryEntry *entries, uint16_t maxEntries);
+// Converts an encoded state into one character per port: O(pen), S(hort), L(oad), N(one) or the through destination
+void FormatState(uint16_t state, char *s);
+const char* SourceName(Source s);
+
 const char* StandardName(Standard s);
 bool NameMatched(const char *name, Standard s);
 
@@ -1,10 +1,13 @@
 #include <Touchstone.hpp>
 
 #include "ff.h"
+#include "Scratch.hpp"
+#include "FileSystem.hpp"
 
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
+#include <cmath>
 
 #define LOG_LEVEL	LOG_LEVEL_INFO
 #define LOG_MODULE	"Touchstone"
@@ -15,11 +18,24 @@ static bool writeFileOpen = false;
 
 static bool writeFactory = false;
 
-static FIL readFile;
-static bool readFileOpen = false;
-static uint32_t nextReadPoint;
-static char readFileFolder[50];
-static char readFileName[50];
+// Two files can be read in parallel, this keeps the reads sequential when interpolating between two sets
+struct Reader {
+	FIL file;
+	bool open;
+	uint32_t nextPoint;
+	uint32_t lastUsed;
+	char folder[50];
+	char name[50];
+};
+static Reader readers[2];
+static uint32_t readerUsage;
+// Incremented whenever files are written or deleted, invalidates the cached set selection
+static uint32_t generation;
+// only incremented by the USB task (drive writes through MSC)
+static volatile uint32_t driveWrites;
+
+static constexpr char temperatureFile[] = "temp.txt";
+
 static bool write_init_lines = false;
 const uint16_t add_comment_limit_per_file = 100;
 static uint16_t add_comment_nb = 0;
@@ -39,7 +55,11 @@ static bool extract_double_values(const char *line, double *values, uint8_t expe
 	return true;
 }
 
-// Returns true if it is a factory file
+static bool validNames(const char *folder, const char *filename) {
+	return strlen(folder) <= Touchstone::MaxNameLength && strlen(filename) <= Touchstone::MaxNameLength;
+}
+
+// Returns true if it is a factory file. The names must have been checked with validNames()
 static bool adjustNames(const char *folder, const char *filename, char *path, char *name) {
 	if(strcmp(folder, "FACTORY") != 0) {
 		sprintf(path, "0:/%s", folder);
@@ -55,6 +75,9 @@ static bool adjustNames(const char *folder, const char *filename, char *path, ch
 static bool open_file(FIL &f, const char *folder, const char *filename, BYTE mode) {
 	char name[50];
 	char path[50];
+	if(!validNames(folder, filename)) {
+		return false;
+	}
 	if(adjustNames(folder, filename, path, name)) {
 		if(mode & (FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_WRITE)) {
 			// write access to factory file requested
@@ -80,24 +103,27 @@ static bool open_file(FIL &f, const char *folder, const char *filename, BYTE mod
 	return res == FR_OK;
 }
 
-static void closeReadFile() {
-	if(readFileOpen) {
-		f_close(&readFile);
-		readFileOpen = false;
+static void closeReadFiles() {
+	for(auto &r : readers) {
+		if(r.open) {
+			f_close(&r.file);
+			r.open = false;
+		}
 	}
 }
 
 uint32_t Touchstone::GetPointNum(const char *folder, const char *filename) {
-	FIL f;
-	if(!open_file(f, folder, filename, FA_OPEN_EXISTING | FA_READ)) {
+	FileSystem::Lock lock;
+	Scratch::Buffer<FIL> f;
+	Scratch::Buffer<char> line(200);
+	if(!f || !line || !open_file(*f, folder, filename, FA_OPEN_EXISTING | FA_READ)) {
 		return 0;
 	}
 	// extract number of ports based on filename ending (s1p or s2p)
 	uint8_t ports = filename[strlen(filename) - 2] - '0';
 	uint8_t values_per_line = 1 + ports*ports*2;
 	uint32_t pointCnt = 0;
-	char line[200];
-	while(f_gets(line, sizeof(line), &f)) {
+	while(f_gets(line, 200, f)) {
 		if(line[0] == '!' || line[0] == '#') {
 			// ignore comments and option line
 			continue;
@@ -107,14 +133,18 @@ uint32_t Touchstone::GetPointNum(const char *folder, const char *filename) {
 			pointCnt++;
 		}
 	}
-	f_close(&f);
+	f_close(f);
 	return pointCnt;
 }
 
 bool Touchstone::StartNewFile(const char *folder, const char *filename) {
+	FileSystem::Lock lock;
 	if(writeFileOpen) {
 		return false;
 	}
+	// the file might currently be open for reading
+	closeReadFiles();
+	generation++;
 	if(!open_file(writeFile, folder, filename, FA_CREATE_ALWAYS | FA_WRITE)) {
 		return false;
 	}
@@ -126,6 +156,7 @@ bool Touchstone::StartNewFile(const char *folder, const char *filename) {
 }
 
 bool Touchstone::AddComment(const char* comment) {
+	FileSystem::Lock lock;
 	if(!writeFileOpen) {
 		return false;
 	}
@@ -146,6 +177,7 @@ bool Touchstone::AddComment(const char* comment) {
 }
 
 bool Touchstone::AddPoint(double frequency, double *values, uint8_t num_values) {
+	FileSystem::Lock lock;
 	if(!writeFileOpen) {
 		return false;
 	}
@@ -179,39 +211,73 @@ bool Touchstone::AddPoint(double frequency, double *values, uint8_t num_values)
 	return true;
 }
 
+bool Touchstone::WriteData(const uint8_t *data, uint16_t len) {
+	FileSystem::Lock lock;
+	if(!writeFileOpen) {
+		return false;
+	}
+	UINT bw;
+	if(f_write(&writeFile, data, len, &bw) != FR_OK || bw != len) {
+		return false;
+	}
+	return true;
+}
+
 bool Touchstone::FinishFile() {
+	FileSystem::Lock lock;
 	if(!writeFileOpen) {
 		return false;
 	}
 	f_close(&writeFile);
 	writeFileOpen = false;
+	generation++;
 	return true;
 }
 
 int Touchstone::GetPoint(const char *folder, const char *filename,
 		uint32_t point, double *values) {
-	if(readFileOpen) {
-		// check if we are still reading from the same file and requesting a later point
-		if(strcmp(folder, readFileFolder) != 0 || strcmp(filename, readFileName) != 0 || nextReadPoint > point) {
-			// either reading a different file or already past requested point
-			closeReadFile();
+	FileSystem::Lock lock;
+	if(!validNames(folder, filename)) {
+		return 0;
+	}
+	// use the reader of this file or replace the least recently used one
+	Reader *r = nullptr;
+	for(auto &candidate : readers) {
+		if(candidate.open && strcmp(folder, candidate.folder) == 0 && strcmp(filename, candidate.name) == 0) {
+			r = &candidate;
+			break;
 		}
 	}
-	if(!readFileOpen) {
+	if(!r) {
+		r = readers[0].lastUsed <= readers[1].lastUsed ? &readers[0] : &readers[1];
+	} else if(r->nextPoint > point) {
+		// already past requested point, start again
+		f_close(&r->file);
+		r->open = false;
+	}
+	r->lastUsed = ++readerUsage;
+	if(!r->open || strcmp(folder, r->folder) != 0 || strcmp(filename, r->name) != 0) {
+		if(r->open) {
+			f_close(&r->file);
+			r->open = false;
+		}
 		// needs to open a new file
-		if(!open_file(readFile, folder, filename, FA_OPEN_EXISTING | FA_READ)) {
+		if(!open_file(r->file, folder, filename, FA_OPEN_EXISTING | FA_READ)) {
 			return 0;
 		}
-		readFileOpen = true;
-		strncpy(readFileFolder, folder, sizeof(readFileFolder));
-		strncpy(readFileName, filename, sizeof(readFileName));
-		nextReadPoint = 0;
+		r->open = true;
+		snprintf(r->folder, sizeof(r->folder), "%s", folder);
+		snprintf(r->name, sizeof(r->name), "%s", filename);
+		r->nextPoint = 0;
 	}
 	uint8_t ports = filename[strlen(filename) - 2] - '0';
 	uint8_t values_per_line = 1 + ports*ports*2;
-	while(nextReadPoint <= point) {
-		char line[200];
-		if(!f_gets(line, sizeof(line), &readFile)) {
+	Scratch::Buffer<char> line(200);
+	if(!line) {
+		return 0;
+	}
+	while(r->nextPoint <= point) {
+		if(!f_gets(line, 200, &r->file)) {
 			return 0;
 		}
 		if(line[0] == '!' || line[0] == '#') {
@@ -219,32 +285,54 @@ int Touchstone::GetPoint(const char *folder, const char *filename,
 			continue;
 		}
 		if(extract_double_values(line, values, values_per_line)) {
-			nextReadPoint++;
+			r->nextPoint++;
 		}
 	}
 	return values_per_line;
 }
 
+uint32_t Touchstone::GetGeneration() {
+	return generation + driveWrites;
+}
+
+void Touchstone::DriveWritten() {
+	driveWrites++;
+}
+
 void Touchstone::EnableFactoryWriting() {
 	writeFactory = true;
 }
 
+bool Touchstone::IsFactoryWritingEnabled() {
+	return writeFactory;
+}
+
+bool Touchstone::IsWriting() {
+	return writeFileOpen;
+}
+
 bool Touchstone::DeleteFile(const char *folder, const char *filename) {
+	FileSystem::Lock lock;
 	char name[50];
 	char path[50];
+	if(!validNames(folder, filename)) {
+		return false;
+	}
 	if(adjustNames(folder, filename, path, name)) {
 		// delete access to factory file requested
 		if(!writeFactory) {
 			return false;
 		}
 	}
+	closeReadFiles();
+	generation++;
 	if(f_chdir(path) != FR_OK) {
 		return false;
 	}
 	if(f_unlink(name) != FR_OK) {
 		return false;
 	}
-	// check if directory is empty now
+	// check if directory is empty now (apart from the temperature of the set)
 	DIR dir;
 	FILINFO fno;
 	if(f_opendir(&dir, path) != FR_OK) {
@@ -253,21 +341,194 @@ bool Touchstone::DeleteFile(const char *folder, const char *filename) {
 		// even if empty
 		return true;
 	}
-	if(f_readdir(&dir, &fno) != FR_OK) {
+	FRESULT res;
+	while((res = f_readdir(&dir, &fno)) == FR_OK && strcmp(fno.fname, temperatureFile) == 0);
+	f_closedir(&dir);
+	if(res != FR_OK) {
 		// same as above
-		f_closedir(&dir);
 		return true;
 	}
-	f_closedir(&dir);
 	if(fno.fname[0] == 0) {
 		// complete directory is empty, delete the folder
+		f_unlink(temperatureFile);
 		f_chdir("0:/");
 		f_unlink(path);
 	}
 	return true;
 }
 
+float Touchstone::GetTemperature(const char *folder) {
+	FileSystem::Lock lock;
+	Scratch::Buffer<FIL> f;
+	float temp = DefaultTemperature;
+	if(f && open_file(*f, folder, temperatureFile, FA_OPEN_EXISTING | FA_READ)) {
+		char line[20];
+		if(f_gets(line, sizeof(line), f)) {
+			char *end;
+			float t = strtof(line, &end);
+			if(end != line) {
+				temp = t;
+			}
+		}
+		f_close(f);
+	}
+	return temp;
+}
+
+bool Touchstone::SetTemperature(const char *folder, float temp) {
+	FileSystem::Lock lock;
+	generation++;
+	// only tag existing sets
+	char name[50];
+	char path[50];
+	if(!validNames(folder, temperatureFile)) {
+		return false;
+	}
+	adjustNames(folder, temperatureFile, path, name);
+	if(f_chdir(path) != FR_OK) {
+		return false;
+	}
+	Scratch::Buffer<FIL> f;
+	if(!f || !open_file(*f, folder, temperatureFile, FA_CREATE_ALWAYS | FA_WRITE)) {
+		return false;
+	}
+	bool success = f_printf(f, "%f\r\n", temp) > 0;
+	return f_close(f) == FR_OK && success;
+}
+
+// The selection is cached, it only changes with the target temperature or the files
+static struct {
+	bool valid;
+	uint32_t generation;
+	float temp;
+	char folder[50];
+	Touchstone::Selection selection;
+} cachedSelection;
+
+static void consider(Touchstone::Selection &s, const char *folder, float target, float &lowerTemp, float &upperTemp) {
+	float temp = Touchstone::GetTemperature(folder);
+	if(temp <= target && (!s.sets[0][0] || temp > lowerTemp)) {
+		snprintf(s.sets[0], sizeof(s.sets[0]), "%s", folder);
+		lowerTemp = temp;
+	}
+	if(temp >= target && (!s.sets[1][0] || temp < upperTemp)) {
+		snprintf(s.sets[1], sizeof(s.sets[1]), "%s", folder);
+		upperTemp = temp;
+	}
+}
+
+Touchstone::Selection Touchstone::SelectSets(const char *folder, float temp) {
+	FileSystem::Lock lock;
+	// the files may also have been changed through the USB drive
+	uint32_t currentGeneration = GetGeneration();
+	if(cachedSelection.valid && cachedSelection.generation == currentGeneration && cachedSelection.temp == temp
+			&& strcmp(cachedSelection.folder, folder) == 0) {
+		return cachedSelection.selection;
+	}
+	Selection s = {};
+	if(strlen(folder) > MaxNameLength) {
+		// no set has this name, the empty selection makes every read fail
+		return s;
+	}
+	float lowerTemp = 0, upperTemp = 0;
+	// the set itself (the factory set always exists)
+	char path[50];
+	snprintf(path, sizeof(path), "0:/%s", folder);
+	FILINFO fno;
+	if(strcmp(folder, "FACTORY") == 0 || f_stat(path, &fno) == FR_OK) {
+		consider(s, folder, temp, lowerTemp, upperTemp);
+	}
+	// and its variants measured at other temperatures
+	DIR dir;
+	auto len = strlen(folder);
+	if(f_opendir(&dir, "0:/") == FR_OK) {
+		while(f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != 0) {
+			// folders created through the drive may have longer names, these can not be used
+			if((fno.fattrib & AM_DIR) && strncmp(fno.fname, folder, len) == 0 && fno.fname[len] == '@'
+					&& strlen(fno.fname) <= MaxNameLength) {
+				consider(s, fno.fname, temp, lowerTemp, upperTemp);
+			}
+		}
+		f_closedir(&dir);
+	}
+	if(!s.sets[0][0] || !s.sets[1][0] || strcmp(s.sets[0], s.sets[1]) == 0 || upperTemp == lowerTemp) {
+		// no interpolation possible or required, use the closest set
+		if(!s.sets[0][0]) {
+			snprintf(s.sets[0], sizeof(s.sets[0]), "%s", s.sets[1][0] ? s.sets[1] : folder);
+		}
+		s.sets[1][0] = '\0';
+		s.weight = 0;
+	} else {
+		s.weight = (temp - lowerTemp) / (upperTemp - lowerTemp);
+	}
+	cachedSelection.valid = true;
+	cachedSelection.generation = currentGeneration;
+	cachedSelection.temp = temp;
+	snprintf(cachedSelection.folder, sizeof(cachedSelection.folder), "%s", folder);
+	cachedSelection.selection = s;
+	return s;
+}
+
+static const char *nearestSet(const Touchstone::Selection &s) {
+	return s.weight > 0.5f ? s.sets[1] : s.sets[0];
+}
+
+uint32_t Touchstone::GetInterpolatedPointNum(const char *folder, const char *filename, float temp) {
+	FileSystem::Lock lock;
+	return GetPointNum(nearestSet(SelectSets(folder, temp)), filename);
+}
+
+int Touchstone::GetInterpolatedPoint(const char *folder, const char *filename, uint32_t point, double *values, float temp) {
+	FileSystem::Lock lock;
+	auto s = SelectSets(folder, temp);
+	if(!s.sets[1][0]) {
+		return GetPoint(s.sets[0], filename, point, values);
+	}
+	double upper[9];
+	int lowerValues = GetPoint(s.sets[0], filename, point, values);
+	int upperValues = GetPoint(s.sets[1], filename, point, upper);
+	if(lowerValues == 0 || lowerValues != upperValues || fabs(values[0] - upper[0]) > 1e-6) {
+		// the sets were not measured at the same frequencies, fall back to the closest set
+		return GetPoint(nearestSet(s), filename, point, values);
+	}
+	for(int i=1;i<lowerValues;i++) {
+		values[i] += (upper[i] - values[i]) * s.weight;
+	}
+	return lowerValues;
+}
+
+bool Touchstone::PrintInterpolatedFile(const char *folder, const char *filename, float temp, SCPI::scpi_tx_callback tx_func, uint8_t interface) {
+	FileSystem::Lock lock;
+	auto s = SelectSets(folder, temp);
+	if(!s.sets[1][0]) {
+		// a single set is used, print the file as it is
+		return PrintFile(s.sets[0], filename, tx_func, interface);
+	}
+	char line[200];
+	double values[9];
+	int num = GetInterpolatedPoint(folder, filename, 0, values, temp);
+	if(num == 0) {
+		// fail the same way as for a missing file
+		tx_func((uint8_t*) "START\r\n", 7, interface);
+		return false;
+	}
+	int len = snprintf(line, sizeof(line), "START\r\n! Interpolated for %.1fC from %s and %s\r\n# GHz S RI R 50.0\r\n",
+			temp, s.sets[0], s.sets[1]);
+	tx_func((uint8_t*) line, len, interface);
+	for(uint32_t point=0;num > 0;num = GetInterpolatedPoint(folder, filename, ++point, values, temp)) {
+		len = 0;
+		for(int i=0;i<num;i++) {
+			len += snprintf(&line[len], sizeof(line) - len, i ? " %f" : "%f", values[i]);
+		}
+		len += snprintf(&line[len], sizeof(line) - len, "\r\n");
+		tx_func((uint8_t*) line, len, interface);
+	}
+	tx_func((uint8_t*) "END\r\n", 5, interface);
+	return true;
+}
+
 bool Touchstone::GetUserCoefficientName(uint8_t index, char *name, uint16_t maxlen) {
+	FileSystem::Lock lock;
 	DIR dir;
 	FILINFO fno;
 	if(f_opendir(&dir, "0:/") != FR_OK) {
@@ -296,9 +557,9 @@ bool Touchstone::GetUserCoefficientName(uint8_t index, char *name, uint16_t maxl
 }
 
 bool Touchstone::PrintFile(const char *folder, const char *filename, SCPI::scpi_tx_callback tx_func, uint8_t interface) {
-	if(readFileOpen) {
-		closeReadFile();
-	}
+	FileSystem::Lock lock;
+	closeReadFiles();
+	auto &readFile = readers[0].file;
 	tx_func((uint8_t*) "START\r\n", 7, interface);
 	if(!open_file(readFile, folder, filename, FA_OPEN_EXISTING | FA_READ)) {
 		return false;
@@ -322,28 +583,111 @@ bool Touchstone::PrintFile(const char *folder, const char *filename, SCPI::scpi_
 	return true;
 }
 
+bool Touchstone::PrintBlock(const char *folder, const char *filename, SCPI::scpi_tx_callback tx_func, uint8_t interface) {
+	FileSystem::Lock lock;
+	closeReadFiles();
+	auto &readFile = readers[0].file;
+	if(!open_file(readFile, folder, filename, FA_OPEN_EXISTING | FA_READ)) {
+		return false;
+	}
+	// definite length block header: #<number of digits><length>
+	uint32_t size = f_size(&readFile);
+	char length[11];
+	snprintf(length, sizeof(length), "%lu", (unsigned long) size);
+	char header[14];
+	snprintf(header, sizeof(header), "#%u%s", (unsigned int) strlen(length), length);
+	tx_func((uint8_t*) header, strlen(header), interface);
+	uint8_t buffer[256];
+	while(size > 0) {
+		UINT br = 0;
+		if(f_read(&readFile, buffer, sizeof(buffer), &br) != FR_OK || br == 0) {
+			// The length has already been announced, keep the framing intact
+			memset(buffer, 0, sizeof(buffer));
+			br = size < sizeof(buffer) ? size : sizeof(buffer);
+		} else if(br > size) {
+			br = size;
+		}
+		tx_func(buffer, br, interface);
+		size -= br;
+	}
+	f_close(&readFile);
+	tx_func((uint8_t*) "\r\n", 2, interface);
+	return true;
+}
+
 // Implemented in main.cpp
 bool createInfoFile();
 extern FATFS fs1;
 
+// Files on the factory drive that are not coefficients, these are kept when the factory drive is cleared
+static constexpr const char *preservedFiles[] = {
+	"1:/heater.txt", // thermal model, see Heater::SaveParameters()
+};
+static constexpr UINT PreservedFileMaxSize = 128;
+
+struct PreservedFile {
+	char data[PreservedFileMaxSize];
+	UINT size;
+	bool present;
+};
+
+static void readPreservedFile(const char *name, PreservedFile &p) {
+	p.present = false;
+	Scratch::Buffer<FIL> f;
+	if(!f || f_open(f, name, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+		return;
+	}
+	if(f_size(f) > sizeof(p.data)) {
+		LOG_WARN("%s too large, not preserved", name);
+	} else if(f_read(f, p.data, sizeof(p.data), &p.size) == FR_OK) {
+		p.present = true;
+	}
+	f_close(f);
+}
+
+static bool writePreservedFile(const char *name, const PreservedFile &p) {
+	if(!p.present) {
+		return true;
+	}
+	Scratch::Buffer<FIL> f;
+	UINT written;
+	if(!f || f_open(f, name, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) {
+		LOG_ERR("Unable to restore %s", name);
+		return false;
+	}
+	bool success = f_write(f, p.data, p.size, &written) == FR_OK && written == p.size;
+	return f_close(f) == FR_OK && success;
+}
+
 bool Touchstone::clearFactory() {
+	FileSystem::Lock lock;
 	if(!writeFactory) {
 		LOG_ERR("Factory deletion not allowed");
 		return false;
 	}
     
     // close any possibly still open file
-    if(readFileOpen) {
-		closeReadFile();
-	}
+    closeReadFiles();
     FinishFile();
+    generation++;
+
+	// the file object and the work area do not fit into the arena at the same time
+	PreservedFile preserved[sizeof(preservedFiles) / sizeof(preservedFiles[0])];
+	for(unsigned int i=0;i<sizeof(preservedFiles) / sizeof(preservedFiles[0]);i++) {
+		readPreservedFile(preservedFiles[i], preserved[i]);
+	}
 
 	// format the factory drive
-	BYTE work[FF_MAX_SS];
 	FRESULT status;
-	if((status = f_mkfs("1:", 0, work, sizeof(work))) != FR_OK) {
-		LOG_ERR("mkfs failed: %d", status);
-		return false;
+	{
+		Scratch::Buffer<BYTE> work(FF_MAX_SS);
+		if(!work) {
+			return false;
+		}
+		if((status = f_mkfs("1:", 0, work, FF_MAX_SS)) != FR_OK) {
+			LOG_ERR("mkfs failed: %d", status);
+			return false;
+		}
 	}
 	if((status = f_mount(&fs1, "1:", 1)) != FR_OK) {
 		LOG_ERR("mount failed: %d", status);
@@ -353,8 +697,12 @@ bool Touchstone::clearFactory() {
 		LOG_ERR("set label failed: %d", status);
 		return false;
 	}
+	bool restored = true;
+	for(unsigned int i=0;i<sizeof(preservedFiles) / sizeof(preservedFiles[0]);i++) {
+		restored &= writePreservedFile(preservedFiles[i], preserved[i]);
+	}
 
 
     // needs to recreate the information file
-    return createInfoFile();
+    return createInfoFile() && restored;
 }
@@ -14,17 +14,49 @@
 
 namespace Touchstone {
 
+// All functions take the filesystem lock (see FileSystem.hpp), they can be called from any task.
+
+// Longest set and file name, the names and paths including the drive prefix are kept in 50 byte
+// buffers. Longer names are rejected
+static constexpr uint8_t MaxNameLength = 45;
+
 uint32_t GetPointNum(const char *folder, const char *filename);
 bool StartNewFile(const char *folder, const char *filename);
 bool AddComment(const char* comment);
 bool AddPoint(double frequency, double *values, uint8_t num_values);
+bool WriteData(const uint8_t *data, uint16_t len);
 bool FinishFile();
 bool DeleteFile(const char *folder, const char *filename);
 int GetPoint(const char *folder, const char *filename, uint32_t point, double *values);
 bool GetUserCoefficientName(uint8_t index, char *name, uint16_t maxlen);
 bool PrintFile(const char *folder, const char *filename, SCPI::scpi_tx_callback tx_func, uint8_t interface);
+bool PrintBlock(const char *folder, const char *filename, SCPI::scpi_tx_callback tx_func, uint8_t interface);
+
+// Coefficient sets are tagged with the temperature they were measured at. Variants of a set measured
+// at other temperatures are named <set>@<suffix>. When reading through the interpolating functions,
+// the two sets closest to the requested temperature are selected and interpolated linearly.
+static constexpr float DefaultTemperature = 35.0f; // for sets without a tag
+float GetTemperature(const char *folder);
+bool SetTemperature(const char *folder, float temp);
+
+struct Selection {
+	char sets[2][50]; // lower and upper set, the upper set is empty if only one set is used
+	float weight; // of the upper set
+};
+Selection SelectSets(const char *folder, float temp);
+uint32_t GetInterpolatedPointNum(const char *folder, const char *filename, float temp);
+int GetInterpolatedPoint(const char *folder, const char *filename, uint32_t point, double *values, float temp);
+bool PrintInterpolatedFile(const char *folder, const char *filename, float temp, SCPI::scpi_tx_callback tx_func, uint8_t interface);
+
+// Incremented whenever a coefficient is written or deleted (through SCPI or the USB drive)
+uint32_t GetGeneration();
+// Called for every write to the user drive through MSC, the files may have been changed
+void DriveWritten();
+// True between StartNewFile and FinishFile, the coefficient being written is incomplete
+bool IsWriting();
 
 void EnableFactoryWriting();
+bool IsFactoryWritingEnabled();
 bool clearFactory();
 
 };
@@ -27,6 +27,7 @@
 #include "bsp/board.h"
 #include "tusb.h"
 #include "Flash.hpp"
+#include "Touchstone.hpp"
 
 extern "C" {
 
@@ -213,6 +214,8 @@ int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t*
   if(lun == 0) {
 	  flash.eraseRange(lba * Flash::SectorSize + offset, bufsize);
 	  flash.write(lba * Flash::SectorSize + offset, bufsize, buffer);
+	  // sets and temperature tags may have been added or changed by the host
+	  Touchstone::DriveWritten();
   }
 #else
   (void) lba; (void) offset; (void) buffer;
@@ -29,13 +29,24 @@
 #include <string.h>
 #include <stdlib.h>     /* atoi */
 #include "tusb.h"
+#include "device/usbd_pvt.h"
 #include "bsp/board_api.h"
 #include "serial.h"
+#include "main.h"
+#include "usbtmc_app.h"
 #include "ff.h"
 #include "Switch.hpp"
+#include "Siglent.hpp"
+#include "Touchstone.hpp"
+#include "FileSystem.hpp"
 #include <ctype.h>
 #include <cstring>
 
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "stream_buffer.h"
+
 #define LOG_LEVEL	LOG_LEVEL_DEBUG
 #define LOG_MODULE	"USB TMC"
 #include "Log.h"
@@ -53,18 +64,381 @@ static usbtmc_response_capabilities_t const tud_usbtmc_app_capabilities = {
     },
 };
 
+/* Every message is either handled here (Siglent dialect) or passed on to the
+ * SCPI module as interface USB_INTERFACE_TMC.  The first packet of a message
+ * decides.  Only Siglent messages are collected in ibuf, SCPI messages may
+ * have any length.
+ */
+static enum { MSG_NEW, MSG_SIGLENT, MSG_SCPI } msg_type = MSG_NEW;
+
 static size_t ibuf_len;
 static uint8_t ibuf[256];
 
+/* SCPI data of the last packet which has not been fetched yet.  The next
+ * packet is only requested once everything has been taken, this throttles
+ * the host while the SCPI task is busy.
+ */
+static const uint8_t *rx_data;
+static size_t rx_len;
+static bool rx_pending;
+static bool rx_terminate;   // append a newline, the message did not end with one
+
+/* SCPI responses are queued until the host asks for them.  tx_ends holds the
+ * stream positions at which a response ends, the transfer reaching such a
+ * position is sent with EOM set.
+ */
+#define TX_STREAM_SIZE 1024
+static StreamBufferHandle_t tx_stream;
+static QueueHandle_t tx_ends;
+static uint32_t tx_written;       // only used by the SCPI task
+static uint32_t tx_read;          // only used by the USB thread
+static uint32_t tx_in_size;       // TransferSize of a bulk-in request waiting for data
+static uint8_t tx_buf[512];
+
 static size_t obuf_pos = 0;
 static size_t obuf_len = 0;
 static uint8_t obuf[1024];
 
-static FIL fl_file;
-static bool fl_file_open = false;
+/* The FL:DATA: commands convert to filesystem reads.  These are done by a
+ * worker task so the USB thread never waits for the flash.  The worker reads
+ * ahead into two chunks which are handed to the USBTMC driver as they are, so
+ * a FL:DATA:READ? larger than a chunk is answered with one USBTMC transfer per
+ * chunk without copying the data again.
+ *
+ * A chunk belongs to the worker while it is not ready and to the USB thread
+ * while it is ready.  All other fl_ state below is only touched by the USB
+ * thread; the worker reports back through usbd_defer_func().
+ */
+#define FL_CHUNK_SIZE 2048
+
+#define FL_CMD_FILL  -2
+#define FL_CMD_INFO  -1
+/* any other command opens data<n>.zip */
+
+typedef struct {
+  uint8_t data[FL_CHUNK_SIZE];
+  size_t len;
+  volatile bool ready;
+} fl_chunk_t;
+
+static fl_chunk_t fl_chunks[2];
+static QueueHandle_t fl_queue;
+
+static enum { FL_CLOSED, FL_OPENING, FL_OPEN } fl_state = FL_CLOSED;
+static uint8_t fl_opens_pending;
+static uint32_t fl_size;
+static uint32_t fl_consumed;
+static uint8_t fl_current;        // chunk the next data is sent from
+static size_t fl_chunk_pos;       // bytes of the current chunk already sent
+static bool fl_response;          // the pending response is file data
+static int32_t fl_request = -1;   // FL:DATA:READ? length waiting for an open to finish
+static uint32_t fl_remaining;     // bytes of the response still to send
+static uint32_t fl_in_size;       // TransferSize of a bulk-in request waiting for data
+static size_t fl_sending;         // bytes of the transfer in flight
+
+static void fl_send(void) {
+  if (!fl_response || !fl_in_size || fl_state == FL_OPENING) {
+    return;
+  }
+  if (fl_state != FL_OPEN) {
+    /* the file is gone, end the response with what has been sent */
+    fl_remaining = 0;
+  }
+  fl_chunk_t *c = &fl_chunks[fl_current];
+  size_t len = 0;
+  if (fl_remaining) {
+    if (!c->ready) {
+      /* fl_chunk_ready() tries again */
+      return;
+    }
+    len = tu_min32(tu_min32(fl_remaining, c->len - fl_chunk_pos), fl_in_size);
+  }
+  fl_in_size = 0;
+  fl_sending = len;
+  tud_usbtmc_transmit_dev_msg_data(c->data + fl_chunk_pos, len, len == fl_remaining, false);
+}
+
+static void fl_sent(void) {
+  fl_chunk_t *c = &fl_chunks[fl_current];
+  fl_chunk_pos += fl_sending;
+  fl_consumed += fl_sending;
+  fl_remaining -= fl_sending;
+  fl_sending = 0;
+  if (c->ready && fl_chunk_pos == c->len) {
+    /* hand the chunk back to the worker */
+    c->ready = false;
+    fl_current ^= 1;
+    fl_chunk_pos = 0;
+    int cmd = FL_CMD_FILL;
+    xQueueSend(fl_queue, &cmd, 0);
+  }
+  if (!fl_remaining) {
+    fl_response = false;
+  }
+}
+
+static void fl_start_response(uint32_t req) {
+  fl_response = true;
+  if (fl_state == FL_OPENING) {
+    fl_request = req;
+    return;
+  }
+  fl_remaining = fl_state == FL_OPEN ? tu_min32(req, fl_size - fl_consumed) : 0;
+}
+
+static void fl_open(int cmd) {
+  if (!fl_queue) {
+    return;
+  }
+  fl_state = FL_OPENING;
+  fl_opens_pending++;
+  xQueueSend(fl_queue, &cmd, portMAX_DELAY);
+}
+
+static void fl_opened(void *param) {
+  if (--fl_opens_pending) {
+    /* another open has been requested in the meantime */
+    return;
+  }
+  int32_t size = (intptr_t) param;
+  fl_state = size < 0 ? FL_CLOSED : FL_OPEN;
+  fl_size = size < 0 ? 0 : size;
+  fl_consumed = 0;
+  fl_current = 0;
+  fl_chunk_pos = 0;
+  if (fl_request >= 0) {
+    fl_start_response(fl_request);
+    fl_request = -1;
+  }
+  fl_send();
+}
+
+static void fl_chunk_ready(void *) {
+  fl_send();
+}
+
+static void fl_read_failed(void *) {
+  if (!fl_opens_pending) {
+    fl_state = FL_CLOSED;
+    fl_send();
+  }
+}
+
+static void fl_reset_response(void) {
+  fl_response = false;
+  fl_request = -1;
+  fl_remaining = 0;
+  fl_in_size = 0;
+}
+
+static bool is_siglent(const char *data, size_t len) {
+  static const char * const prefixes[] = {"FL:DATA", "SL ", "SET:PORT"};
+  for (auto p : prefixes) {
+    if (len >= strlen(p) && !strncasecmp(data, p, strlen(p))) {
+      return true;
+    }
+  }
+  /* the VNA expects its own identification */
+  return getUsbMode() == MODE_SIGLENT && len >= 5 && !strncasecmp(data, "*IDN?", 5);
+}
+
+static void tx_send(void) {
+  if (!tx_in_size) {
+    return;
+  }
+  uint32_t end;
+  bool has_end = xQueuePeek(tx_ends, &end, 0);
+  size_t max = tu_min32(tx_in_size, sizeof(tx_buf));
+  if (has_end) {
+    max = tu_min32(max, end - tx_read);
+  }
+  size_t n = xStreamBufferReceive(tx_stream, tx_buf, max, 0);
+  tx_read += n;
+  bool eom = has_end && end == tx_read;
+  if (!n && !eom) {
+    /* tx_available() tries again */
+    return;
+  }
+  if (eom) {
+    xQueueReceive(tx_ends, &end, 0);
+  }
+  tx_in_size = 0;
+  tud_usbtmc_transmit_dev_msg_data(tx_buf, n, eom, false);
+}
+
+static void tx_available(void *) {
+  tx_send();
+}
+
+/* Drops queued response data, up to the end of the current response or everything */
+static void tx_discard(bool all) {
+  tx_in_size = 0;
+  do {
+    uint32_t end;
+    bool has_end = xQueuePeek(tx_ends, &end, 0);
+    size_t max = has_end ? end - tx_read : SIZE_MAX;
+    size_t n;
+    while (max && (n = xStreamBufferReceive(tx_stream, tx_buf, tu_min32(max, sizeof(tx_buf)), 0))) {
+      tx_read += n;
+      max -= n;
+    }
+    if (!has_end || max) {
+      break;
+    }
+    xQueueReceive(tx_ends, &end, 0);
+  } while (all);
+}
+
+extern "C" uint16_t usbtmc_app_receive(uint8_t *data, uint16_t maxlen) {
+  uint16_t n = tu_min32(rx_len, maxlen);
+  memcpy(data, rx_data, n);
+  rx_data += n;
+  rx_len -= n;
+  if (!rx_len && rx_terminate && n < maxlen) {
+    data[n++] = '\n';
+    rx_terminate = false;
+  }
+  if (rx_pending && !rx_len && !rx_terminate) {
+    /* everything taken, ready for the next packet */
+    rx_pending = false;
+    tud_usbtmc_start_bus_read();
+  }
+  return n;
+}
+
+extern "C" bool usbtmc_app_transmit(const uint8_t *data, uint16_t length, uint32_t timeout_ms) {
+  if (!tx_stream) {
+    return false;
+  }
+  while (length) {
+    size_t n = xStreamBufferSend(tx_stream, data, length, pdMS_TO_TICKS(timeout_ms));
+    if (!n) {
+      /* host is not reading, drop the rest */
+      return false;
+    }
+    tx_written += n;
+    data += n;
+    length -= n;
+    usbd_defer_func(tx_available, NULL, false);
+  }
+  return true;
+}
+
+extern "C" void usbtmc_app_transmit_end(void) {
+  if (!tx_stream) {
+    return;
+  }
+  uint32_t end = tx_written;
+  /* if too many responses are unread, this one is merged with the next */
+  if (xQueueSend(tx_ends, &end, 0) == pdTRUE) {
+    usbd_defer_func(tx_available, NULL, false);
+  }
+}
+
+/* Opens a file for the worker, either generated from the selected coefficient
+ * set or stored in the siglent folder.  Returns the size or -1.
+ */
+static int32_t fl_task_open(FIL *file, bool *generated, int cmd) {
+  FileSystem::Lock lock;
+  *generated = Siglent::IsEnabled();
+  if (*generated) {
+    if (cmd == FL_CMD_INFO) {
+      return Siglent::Open(Siglent::File::Info);
+    } else if (cmd == 0) {
+      return Siglent::Open(Siglent::File::Data);
+    }
+    return -1;
+  }
+  /* absolute paths, the Touchstone module changes the current directory */
+  char name[32];
+  if (cmd == FL_CMD_INFO) {
+    strcpy(name, "0:/siglent/info.dat");
+  } else {
+    snprintf(name, sizeof(name), "0:/siglent/data%d.zip", cmd);
+  }
+  if (f_open(file, name, FA_OPEN_EXISTING | FA_READ) != FR_OK) {
+    return -1;
+  }
+  return f_size(file);
+}
+
+static void fl_task(void *) {
+  static FIL file;
+  bool open = false;
+  bool generated = false;
+  bool eof = true;
+  uint32_t left = 0;
+  uint8_t fill = 0;
+  uint32_t idle_generation = Touchstone::GetGeneration();
+  while (1) {
+    int cmd;
+    if (xQueueReceive(fl_queue, &cmd, pdMS_TO_TICKS(1000)) != pdTRUE) {
+      /* Prepare the generated data while the VNA is not reading, so the first
+       * FL:DATA: access does not wait for it.  Only once the coefficients have
+       * not changed for a while (a set is usually written file by file) and no
+       * coefficient is being written, this avoids needless rebuilds.  The
+       * filesystem lock taken by Update() keeps the coefficients consistent.
+       */
+      uint32_t generation = Touchstone::GetGeneration();
+      if (getUsbMode() == MODE_SIGLENT && generation == idle_generation
+          && !Touchstone::IsWriting()) {
+        Siglent::Update();
+      }
+      idle_generation = generation;
+      continue;
+    }
+    if (cmd != FL_CMD_FILL) {
+      if (open && !generated) {
+        FileSystem::Lock lock;
+        f_close(&file);
+      }
+      int32_t size = fl_task_open(&file, &generated, cmd);
+      open = size >= 0;
+      eof = !open;
+      left = open ? size : 0;
+      fill = 0;
+      fl_chunks[0].ready = false;
+      fl_chunks[1].ready = false;
+      usbd_defer_func(fl_opened, (void*) (intptr_t) size, false);
+    }
+    /* read ahead into every chunk the USB thread has given back */
+    while (!eof && !fl_chunks[fill].ready) {
+      UINT rv;
+      if (generated) {
+        rv = Siglent::Read(fl_chunks[fill].data, FL_CHUNK_SIZE);
+      } else {
+        FileSystem::Lock lock;
+        if (f_read(&file, fl_chunks[fill].data, FL_CHUNK_SIZE, &rv) != FR_OK) {
+          rv = 0;
+        }
+      }
+      if (rv == 0) {
+        eof = true;
+        if (left) {
+          /* shorter than announced, e.g. the generated data was rebuilt */
+          LOG_ERR("Failed to read file");
+          usbd_defer_func(fl_read_failed, NULL, false);
+        }
+        break;
+      }
+      left -= tu_min32(rv, left);
+      fl_chunks[fill].len = rv;
+      __atomic_signal_fence(__ATOMIC_SEQ_CST);
+      fl_chunks[fill].ready = true;
+      fill ^= 1;
+      usbd_defer_func(fl_chunk_ready, NULL, false);
+    }
+  }
+}
 
 extern "C" void tud_usbtmc_open_cb(uint8_t interface_id) {
   (void)interface_id;
+  if (!fl_queue) {
+    fl_queue = xQueueCreate(4, sizeof(int));
+    xTaskCreate(fl_task, "SiglentFL", 1024, NULL, 3, NULL);
+    tx_ends = xQueueCreate(16, sizeof(uint32_t));
+    tx_stream = xStreamBufferCreate(TX_STREAM_SIZE, 1);
+  }
   tud_usbtmc_start_bus_read();
 }
 
@@ -79,16 +453,29 @@ extern "C" bool tud_usbtmc_msg_trigger_cb(usbtmc_msg_generic_t* msg) {
 }
 
 extern "C" bool tud_usbtmc_msgBulkOut_start_cb(usbtmc_msg_request_dev_dep_out const * msgHeader) {
+  (void)msgHeader;
+  msg_type = MSG_NEW;
   ibuf_len = 0;
   obuf_pos = 0;
   obuf_len = 0;
-  if (msgHeader->TransferSize > sizeof(ibuf)) {
-    return false;
-  }
+  fl_reset_response();
   return true;
 }
 
 extern "C" bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_complete) {
+  if (msg_type == MSG_NEW) {
+    msg_type = is_siglent((const char *)data, len) ? MSG_SIGLENT : MSG_SCPI;
+  }
+  if (msg_type == MSG_SCPI) {
+    /* the packet stays in the endpoint buffer until usbtmc_app_receive() took it */
+    rx_data = (const uint8_t *)data;
+    rx_len = len;
+    rx_pending = true;
+    rx_terminate = transfer_complete && (len == 0 || rx_data[len - 1] != '\n');
+    usbtmc_app_rx_cb();
+    return true;
+  }
+
   if (len + ibuf_len < sizeof(ibuf)) {
     memcpy(&(ibuf[ibuf_len]), data, len);
     ibuf_len += len;
@@ -115,32 +502,20 @@ extern "C" bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_com
       obuf_pos = 0;
       obuf_len = snprintf((char *)obuf, sizeof(obuf), "LibreVNA,LibreCAL,%s,%d.%d.%d\n", getSerial(), FW_MAJOR, FW_MINOR, FW_PATCH);
   } else if (!strcasecmp((char *)ibuf, "FL:DATA:READ:START\n")) {
-    /* The FL:DATA: commands convert to filesystem reads and writes.  In a
-     * more serious USB device, we would kick these onto another thread, but
-     * for this application it's ok to block the USB thread for the small
-     * reads.
-     */
-    fl_file_open = f_open(&fl_file, "0:siglent/info.dat", FA_OPEN_EXISTING | FA_READ) == FR_OK;
+    fl_open(FL_CMD_INFO);
   } else if (!strncasecmp((char *)ibuf, "FL:DATA:INDEX ", 14)) {
     int idx = atoi((char *)ibuf + 14);
-    char name[32];
-    snprintf(name, sizeof(name), "0:siglent/data%d.zip", idx);
-    fl_file_open = f_open(&fl_file, name, FA_OPEN_EXISTING | FA_READ) == FR_OK;
-  } else if (!strncasecmp((char *)ibuf, "FL:DATA:READ? ", 14)) {
-    size_t req = atoi((char *)ibuf + 14);
-    
-    size_t len = tu_min32(sizeof(obuf), req);
-    size_t rv;
-    
-    if (!fl_file_open) {
+    if (idx < 0) {
       goto done;
     }
-    
-    if (f_read(&fl_file, obuf, len, &rv) != FR_OK) {
+    fl_open(idx);
+  } else if (!strncasecmp((char *)ibuf, "FL:DATA:READ? ", 14)) {
+    int req = atoi((char *)ibuf + 14);
+    if (req < 0) {
       goto done;
     }
-
-    obuf_len = rv;
+    /* answered from the read-ahead chunks once the host asks for it */
+    fl_start_response(req);
   } else if (!strncasecmp((char *)ibuf, "SL ", 3)) {
     /* This is not a very robust parser. */
     char *buf = (char *)ibuf + 3;
@@ -154,11 +529,11 @@ extern "C" bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_com
     }
     int srcport = atoi(srcport_s) - 1;
     if (!strcasecmp(cmd, "OPEN")) {
-      Switch::SetStandard(srcport, Switch::Standard::Open);
+      Switch::SetStandard(srcport, Switch::Standard::Open, Switch::Source::TMC);
     } else if (!strcasecmp(cmd, "SHORT")) {
-      Switch::SetStandard(srcport, Switch::Standard::Short);
+      Switch::SetStandard(srcport, Switch::Standard::Short, Switch::Source::TMC);
     } else if (!strcasecmp(cmd, "LOAD")) {
-      Switch::SetStandard(srcport, Switch::Standard::Load);
+      Switch::SetStandard(srcport, Switch::Standard::Load, Switch::Source::TMC);
     } else if (!strcasecmp(cmd, "THRU") || !strcasecmp(cmd, "ATT")) {
       // Since we don't have an attenuator, we fake "SL ATT,n,m" with "THRU"
       // by providing the through coefficients for CF_*.
@@ -167,7 +542,7 @@ extern "C" bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_com
         goto done;
       }
       int dstport = atoi(dstport_s) - 1;
-      Switch::SetThrough(srcport, dstport);
+      Switch::SetThrough(srcport, dstport, Switch::Source::TMC);
     } else {
     	goto done;
     }
@@ -194,7 +569,7 @@ extern "C" bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_com
 			  LOG_ERR("%d ports given for THRU", port_cnt);
 			  goto done;
 		  }
-		  Switch::SetThrough(ports[0], ports[1]);
+		  Switch::SetThrough(ports[0], ports[1], Switch::Source::TMC);
 		  goto done;
 	  }
 	  // handle the other standards
@@ -210,7 +585,7 @@ extern "C" bool tud_usbtmc_msg_data_cb(void *data, size_t len, bool transfer_com
 		  goto done;
 	  }
 	  for(uint8_t i=0;i<port_cnt;i++) {
-		  Switch::SetStandard(ports[i], s);
+		  Switch::SetStandard(ports[i], s, Switch::Source::TMC);
 	  }
   } else {
 	  LOG_ERR("Unknown command: %s", ibuf);
@@ -223,12 +598,26 @@ done:
 }
 
 extern "C" bool tud_usbtmc_msgBulkIn_complete_cb() {
+  if (msg_type == MSG_SIGLENT && fl_response) {
+    fl_sent();
+  }
   tud_usbtmc_start_bus_read();
 
   return true;
 }
 
 extern "C" bool tud_usbtmc_msgBulkIn_request_cb(usbtmc_msg_request_dev_dep_in const * request) {
+  if (msg_type != MSG_SIGLENT) {
+    tx_in_size = request->TransferSize;
+    tx_send();
+    return true;
+  }
+  if (fl_response) {
+    fl_in_size = request->TransferSize;
+    fl_send();
+    return true;
+  }
+
   size_t txlen = tu_min32(obuf_len - obuf_pos, request->TransferSize);
   if (txlen == 0) {
     return true;
@@ -252,6 +641,14 @@ extern "C" bool tud_usbtmc_check_clear_cb(usbtmc_get_clear_status_rsp_t *rsp) {
   ibuf_len = 0;
   obuf_len = 0;
   obuf_pos = 0;
+  fl_reset_response();
+  tx_discard(true);
+  if (rx_pending) {
+    rx_len = 0;
+    rx_terminate = false;
+    rx_pending = false;
+    tud_usbtmc_start_bus_read();
+  }
   rsp->USBTMC_status = USBTMC_STATUS_SUCCESS;
   rsp->bmClear.BulkInFifoBytes = 0u;
   return true;
@@ -264,6 +661,11 @@ extern "C" bool tud_usbtmc_initiate_abort_bulk_in_cb(uint8_t *tmcResult) {
 
 extern "C" bool tud_usbtmc_check_abort_bulk_in_cb(usbtmc_check_abort_bulk_rsp_t *rsp) {
   (void)rsp;
+  if (msg_type == MSG_SIGLENT) {
+    fl_reset_response();
+  } else {
+    tx_discard(false);
+  }
   tud_usbtmc_start_bus_read();
   return true;
 }
@@ -64,9 +64,10 @@
   #error "Incorrect RHPort configuration"
 #endif
 
-#ifndef CFG_TUSB_OS
-#define CFG_TUSB_OS               OPT_OS_NONE
-#endif
+// The Pico SDK defines OPT_OS_PICO, which never blocks in tud_task(). With the FreeRTOS OSAL,
+// the TinyUSB task waits on the event queue and only runs when there is something to do
+#undef CFG_TUSB_OS
+#define CFG_TUSB_OS               OPT_OS_FREERTOS
 
 // CFG_TUSB_DEBUG is defined by compiler in DEBUG build
 // #define CFG_TUSB_DEBUG           0
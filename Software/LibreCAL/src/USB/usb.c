@@ -1,11 +1,21 @@
 #include <usb.h>
 #include <usb_descriptors.h>
+#include "usbtmc_app.h"
 #include "tusb.h"
+#include "device/usbd_pvt.h"
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "semphr.h"
 
 static usbd_recv_callback_t callback;
+static usbd_trigger_callback_t trigger;
+
+// Given whenever a transfer on the IN endpoint of an interface completed (space in the TX FIFO)
+static SemaphoreHandle_t tx_done[USB_NUM_INTERFACES];
+static StaticSemaphore_t tx_done_buffer[USB_NUM_INTERFACES];
+// Gives up on a transmission if the host does not read any data for this long
+#define USB_TX_TIMEOUT_MS		1000
 
 // Invoked when a control transfer occurred on an interface of this class
 // Driver response accordingly to the request and the transfer stage (setup/data/ack)
@@ -33,6 +43,12 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
             return false;
           }
 
+        case VENDOR_REQUEST_TRIGGER:
+          // trigger without data stage, the trigger itself is handled outside of the TinyUSB task
+          if (request->bmRequestType_bit.direction != TUSB_DIR_OUT || request->wLength != 0) return false;
+          if (trigger) trigger();
+          return tud_control_status(rhport, request);
+
         default: break;
       }
     break;
@@ -44,93 +60,119 @@ bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_requ
   return false;
 }
 
-//static char *strnstr(const char *s1, const char *s2, int length) {
-//	if(!s1 || !s2) {
-//		return NULL;
-//	}
-//	int cmpLen = strlen(s2);
-//	for(int i=0;i<=length-cmpLen;i++) {
-//		if(strncmp(&s[i], s2, cmpLen) == 0) {
-//			return &s[i];
-//		}
-//	}
-//	return NULL;
-//}
-
-static void handleIncoming(char *buf, uint16_t *recCnt, uint8_t interface) {
-	uint16_t cnt = 0;
-	if(interface == USB_INTERFACE_CDC) {
-		if(tud_cdc_available()) {
-			cnt = tud_cdc_read(&buf[*recCnt], USB_REC_BUFFER_SIZE - *recCnt);
-		}
-	} else {
-		if(tud_vendor_available()) {
-			cnt = tud_vendor_read(&buf[*recCnt], USB_REC_BUFFER_SIZE - *recCnt);
-		}
-	}
-	*recCnt += cnt;
-	char *lineEnd;
-	while(lineEnd = memchr(buf, '\n', *recCnt)) {
-		uint16_t bytes = lineEnd - buf + 1;
-		if(callback) {
-			callback(buf, bytes, interface);
-		}
-		if(*recCnt > bytes) {
-			// got more bytes already received
-			memmove(buf, &buf[bytes], *recCnt - bytes);
-			*recCnt -= bytes;
-		} else {
-			*recCnt = 0;
-		}
+// Invoked when CDC interface received data from host
+void tud_cdc_rx_cb(uint8_t itf)
+{
+	// The data stays in the FIFO until the application fetches it with usb_receive. This way,
+	// nothing is lost when the application is busy and the host is throttled once the FIFO is full
+	if(callback) {
+		callback(USB_INTERFACE_CDC);
 	}
 }
 
-// Invoked when CDC interface received data from host
-void tud_cdc_rx_cb(uint8_t itf)
+void tud_vendor_rx_cb(uint8_t itf, uint8_t const* buffer, uint16_t bufsize)
 {
-	static uint8_t buf[USB_REC_BUFFER_SIZE];
-	static uint16_t recCnt = 0;
+	if(callback) {
+		callback(USB_INTERFACE_VENDOR);
+	}
+}
 
-	handleIncoming(buf, &recCnt, USB_INTERFACE_CDC);
+void tud_cdc_tx_complete_cb(uint8_t itf)
+{
+	xSemaphoreGive(tx_done[USB_INTERFACE_CDC]);
 }
 
-void tud_vendor_rx_cb(uint8_t itf, uint8_t const* buffer, uint16_t bufsize)
+void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes)
 {
-	static uint8_t buf[USB_REC_BUFFER_SIZE];
-	static uint16_t recCnt = 0;
+	xSemaphoreGive(tx_done[USB_INTERFACE_VENDOR]);
+}
 
-	handleIncoming(buf, &recCnt, USB_INTERFACE_VENDOR);
+void usbtmc_app_rx_cb(void)
+{
+	if(callback) {
+		callback(USB_INTERFACE_TMC);
+	}
 }
 
 static void tinyUSB_task(void* ptr) {
 	while(true) {
-		tud_task();
+		// blocks until a USB event is available
+		tud_task_ext(UINT32_MAX, false);
 	}
 }
 
 static TaskHandle_t usb_task;
 
-void usb_init(usbd_recv_callback_t receive_callback) {
+void usb_init(usbd_recv_callback_t receive_callback, usbd_trigger_callback_t trigger_callback) {
 	callback = receive_callback;
+	trigger = trigger_callback;
+	for(uint8_t i=0;i<USB_NUM_INTERFACES;i++) {
+		tx_done[i] = xSemaphoreCreateBinaryStatic(&tx_done_buffer[i]);
+	}
 	tud_init(0);
-	xTaskCreate(tinyUSB_task, "TinyUSB", 1024, NULL, 3, &usb_task);
+	// The task only runs on USB events, a higher priority than the application tasks keeps the
+	// latency low without starving them
+	xTaskCreate(tinyUSB_task, "TinyUSB", 1024, NULL, 4, &usb_task);
 }
-bool usb_transmit(const uint8_t *data, uint16_t length, uint8_t i) {
+static void resume_rx(void *param) {
+	if(callback) {
+		callback((usb_interface_t) (uintptr_t) param);
+	}
+}
+
+void usb_resume_receive(uint8_t i) {
+	// the receive callback is always executed in the context of the TinyUSB task
+	usbd_defer_func(resume_rx, (void*) (uintptr_t) i, false);
+}
+
+uint16_t usb_receive(uint8_t *data, uint16_t maxlen, uint8_t i) {
 	if(i == USB_INTERFACE_CDC) {
-		while(tud_cdc_write_available() < length) {
-			vTaskDelay(1);
-		}
-		tud_cdc_write(data, length);
-		tud_cdc_write_flush();
+		return tud_cdc_read(data, maxlen);
 	} else if(i == USB_INTERFACE_VENDOR) {
-		while(tud_vendor_write_available() < length) {
-			vTaskDelay(1);
+		return tud_vendor_read(data, maxlen);
+	} else if(i == USB_INTERFACE_TMC) {
+		return usbtmc_app_receive(data, maxlen);
+	}
+	return 0;
+}
+
+bool usb_transmit(const uint8_t *data, uint16_t length, uint8_t i) {
+	if(i >= USB_NUM_INTERFACES) {
+		return false;
+	}
+	if(i == USB_INTERFACE_TMC) {
+		// USBTMC responses are only sent when the host requests them, they are queued in the meantime
+		return usbtmc_app_transmit(data, length, USB_TX_TIMEOUT_MS);
+	}
+	while(length > 0) {
+		// write as much as fits into the FIFO, the remaining data follows once a transfer completed
+		uint32_t written = 0;
+		if(i == USB_INTERFACE_CDC) {
+			written = tud_cdc_write(data, length);
+			tud_cdc_write_flush();
+		} else if(i == USB_INTERFACE_VENDOR) {
+			written = tud_vendor_write(data, length);
+			tud_vendor_write_flush();
 		}
-		tud_vendor_write(data, length);
-		tud_vendor_write_flush();
+		data += written;
+		length -= written;
+		if(length > 0 && written == 0) {
+			// FIFO full. A completion that happened in the meantime is still pending in the
+			// semaphore, so no wakeup can be missed
+			if(!tud_mounted() || xSemaphoreTake(tx_done[i], pdMS_TO_TICKS(USB_TX_TIMEOUT_MS)) != pdTRUE) {
+				// host is not reading, drop the rest
+				return false;
+			}
+		}
+	}
+	return true;
+}
+void usb_transmit_end(uint8_t i) {
+	if(i == USB_INTERFACE_TMC) {
+		usbtmc_app_transmit_end();
 	}
-    return true;
 }
+
 uint16_t usb_available_buffer() {
 
 }
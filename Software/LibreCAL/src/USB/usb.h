@@ -7,19 +7,28 @@ extern "C" {
 #include <stdint.h>
 #include <stdbool.h>
 
-#define USB_REC_BUFFER_SIZE		256
-
 typedef enum {
 	USB_INTERFACE_CDC = 0,
 	USB_INTERFACE_VENDOR = 1,
+	USB_INTERFACE_TMC = 2,
 } usb_interface_t;
 
-typedef void(*usbd_recv_callback_t)(const uint8_t *buf, uint16_t len, usb_interface_t i);
+// Signals that received data is available on an interface (read it with usb_receive)
+typedef void(*usbd_recv_callback_t)(usb_interface_t i);
+// Signals a trigger request received on the control endpoint (called from the TinyUSB task)
+typedef void(*usbd_trigger_callback_t)(void);
+
+#define USB_NUM_INTERFACES		3
 
-void usb_init(usbd_recv_callback_t receive_callback);
+void usb_init(usbd_recv_callback_t receive_callback, usbd_trigger_callback_t trigger_callback);
 void usb_is_siglent();
 uint16_t usb_available_buffer();
+uint16_t usb_receive(uint8_t *data, uint16_t maxlen, uint8_t interface);
+// Calls the receive callback again (from the TinyUSB task), used when data was left in the FIFO
+void usb_resume_receive(uint8_t interface);
 bool usb_transmit(const uint8_t *data, uint16_t length, uint8_t interface);
+// Marks the end of a response. Only relevant for USBTMC, where the last transfer of a response carries the EOM flag
+void usb_transmit_end(uint8_t interface);
 void usb_log(const char *log, uint16_t length);
 void usb_clear_buffer();
 
@@ -103,6 +103,7 @@ enum
   ITF_DEF_NUM_CDC_DATA,
   ITF_DEF_NUM_VENDOR,
   ITF_DEF_NUM_MSC,
+  ITF_DEF_NUM_TMC,
   ITF_DEF_NUM_TOTAL
 };
 
@@ -115,6 +116,8 @@ enum
 #define EPNUM_MSC_OUT    	4
 #define EPNUM_MSC2_IN	   	5
 #define EPNUM_MSC2_OUT   	5
+#define EPNUM_DEF_TMC_IN	6
+#define EPNUM_DEF_TMC_OUT	6
 
 // Siglent mode
 enum
@@ -128,7 +131,7 @@ enum
 #define EPNUM_TMC_IN     	3
 #define EPNUM_TMC_OUT    	3
 
-#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_VENDOR_DESC_LEN + TUD_MSC_DESC_LEN)
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_VENDOR_DESC_LEN + TUD_MSC_DESC_LEN + TUD_USBTMC_IF_DESCRIPTOR_LEN + TUD_USBTMC_BULK_DESCRIPTORS_LEN)
 
 uint8_t const desc_configuration_default[] =
 {
@@ -143,6 +146,10 @@ uint8_t const desc_configuration_default[] =
 
   // Interface number, string index, EP Out & EP In address, EP size
   TUD_MSC_DESCRIPTOR(ITF_DEF_NUM_MSC, 6, EPNUM_MSC_OUT, 0x80 | EPNUM_MSC_IN, 64),
+
+  // USBTMC for VISA based automation, added last to keep the numbers of the other interfaces
+  TUD_USBTMC_IF_DESCRIPTOR(ITF_DEF_NUM_TMC, /* _bNumEndpoints = */ 2u,  /*_stridx = */ 9u, 0 /* no subclass */),
+  TUD_USBTMC_BULK_DESCRIPTORS(/* OUT = */ EPNUM_DEF_TMC_OUT, /* IN = */ 0x80 | EPNUM_DEF_TMC_IN, /* packet size = */ 64),
 };
 
 /* We don't want a MSC device to confuse the UI and attempt to save files to
@@ -263,6 +270,7 @@ char const* string_desc_arr [] =
   "LibreCAL Storage",			// 6: MSC Interface
   "LibreCAL Siglent TMC",         // 7: USBTMC interface
   "LibreCAL (Siglent eCal emulation mode)", // 8: Product ID in eCal emulation mode
+  "LibreCAL TMC",                 // 9: USBTMC interface in default mode
 };
 
 static uint16_t _desc_str[64];
@@ -29,7 +29,8 @@
 
 enum
 {
-  VENDOR_REQUEST_MICROSOFT = 1
+  VENDOR_REQUEST_MICROSOFT = 1,
+  VENDOR_REQUEST_TRIGGER = 2,
 };
 
 extern uint8_t const desc_ms_os_20[];
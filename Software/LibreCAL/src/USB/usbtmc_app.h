@@ -0,0 +1,24 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Glue between the USBTMC interface (siglent_tmc.cpp) and the generic USB functions in usb.c.
+// Messages that are not part of the Siglent dialect are passed on as SCPI interface USB_INTERFACE_TMC.
+
+// Called from the TinyUSB task when SCPI data is available (implemented in usb.c)
+void usbtmc_app_rx_cb(void);
+// Fetches received SCPI data, must be called from the TinyUSB task
+uint16_t usbtmc_app_receive(uint8_t *data, uint16_t maxlen);
+// Queues response data until the host requests it
+bool usbtmc_app_transmit(const uint8_t *data, uint16_t length, uint32_t timeout_ms);
+// Ends the current response, the next transfer reaching this point is sent with EOM set
+void usbtmc_app_transmit_end(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -97,7 +97,7 @@ void Task(void*) {
 			case Switch::Standard::Through: state = Switch::Standard::None; break;
 			case Switch::Standard::None: state = Switch::Standard::Open; break;
 			}
-			Switch::SetStandard(selectedPort, state);
+			Switch::SetStandard(selectedPort, state, Switch::Source::Button);
 		}
 
 		// update LEDs
@@ -4,6 +4,7 @@
 
 #include "flashdisk.h"
 #include "Flash.hpp"
+#include "Perf.hpp"
 
 #include "hardware/rtc.h"
 
@@ -60,7 +61,9 @@ DRESULT disk_read (
 		address += FF_FLASH_DISK0_SIZE;
 	}
 
+	auto start = Perf::Now();
 	flash.read(address, size, buff);
+	Perf::Record(Perf::Section::DiskRead, start);
 
 	return RES_OK;
 }
@@ -101,8 +104,10 @@ DRESULT disk_write (
 		address += FF_FLASH_DISK0_SIZE;
 	}
 
+	auto start = Perf::Now();
 	flash.eraseRange(address, size);
 	flash.write(address, size, buff);
+	Perf::Record(Perf::Section::DiskWrite, start);
 
 	return RES_OK;
 }
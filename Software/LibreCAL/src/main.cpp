@@ -13,12 +13,17 @@
 
 #include "FreeRTOS.h"
 #include "task.h"
+#include "stream_buffer.h"
 
 #include "Switch.hpp"
 #include "SCPI.hpp"
 #include "Flash.hpp"
 #include "UserInterface.hpp"
 #include "Heater.hpp"
+#include "Status.hpp"
+#include "Sequence.hpp"
+#include "Siglent.hpp"
+#include "Scratch.hpp"
 
 #define LOG_LEVEL	LOG_LEVEL_INFO
 #define LOG_MODULE	"App"
@@ -57,10 +62,21 @@ FATFS fs0, fs1;
 FIL fil;
 FRESULT fr;
 
-static char usb_buffer[256];
-static uint16_t usb_len;
-static usb_interface_t usb_interface;
-static xTaskHandle handle;
+// Received data is queued per interface until the SCPI task processes it
+#define RX_STREAM_SIZE		1024
+// Data is taken from the queue in chunks of this size, larger chunks need fewer critical sections
+#define RX_CHUNK_SIZE		256
+
+static StreamBufferHandle_t rxStream[USB_NUM_INTERFACES];
+static volatile bool rxStalled[USB_NUM_INTERFACES];
+static xTaskHandle scpiTaskHandle;
+// Notification bit for the SCPI task, set when the device status changed
+#define STATUS_NOTIFICATION	(1UL << USB_NUM_INTERFACES)
+// Notification bit for the SCPI task, set by a trigger request on the USB control endpoint
+#define TRIGGER_NOTIFICATION	(1UL << (USB_NUM_INTERFACES + 1))
+// The trigger requests are also counted in this notification index, every trigger must advance the
+// sequence by one step even if several arrive while the SCPI task is busy (index 1 is used by Flash)
+#define TRIGGER_COUNT_INDEX		2
 
 Flash flash(spi0, FLASH_CLK_PIN, FLASH_MOSI_PIN, FLASH_MISO_PIN, FLASH_CS_PIN);
 
@@ -70,15 +86,70 @@ ecal_usb_mode_t getUsbMode() {
 	return mode;
 }
 
-static void usb_rx(const uint8_t *buf, uint16_t len, usb_interface_t i) {
-	if(len > sizeof(usb_buffer)) {
-		// line too long
-		return;
+// Called from the TinyUSB task whenever new data is available
+static void usb_rx(usb_interface_t i) {
+	uint8_t buffer[64];
+	while(true) {
+		auto space = xStreamBufferSpacesAvailable(rxStream[i]);
+		if(space == 0) {
+			// Queue is full. Leave the remaining data in the USB FIFO, this throttles the host
+			// once the FIFO is full as well. Resumed by the SCPI task after it caught up.
+			rxStalled[i] = true;
+			break;
+		}
+		auto len = usb_receive(buffer, space < sizeof(buffer) ? space : sizeof(buffer), i);
+		if(len == 0) {
+			break;
+		}
+		xStreamBufferSend(rxStream[i], buffer, len, 0);
+	}
+	xTaskNotify(scpiTaskHandle, 1UL << i, eSetBits);
+}
+
+// Called from the TinyUSB task for a trigger control request
+static void usb_trigger() {
+	xTaskNotifyIndexed(scpiTaskHandle, TRIGGER_COUNT_INDEX, 0, eIncrement);
+	xTaskNotify(scpiTaskHandle, TRIGGER_NOTIFICATION, eSetBits);
+}
+
+// Called by the status module whenever a condition changed
+static void status_changed() {
+	if(scpiTaskHandle) {
+		xTaskNotify(scpiTaskHandle, STATUS_NOTIFICATION, eSetBits);
+	}
+}
+
+static void scpiTask(void* ptr) {
+	while(true) {
+		uint32_t notification;
+		if(xTaskNotifyWait(0, UINT32_MAX, &notification, portMAX_DELAY)) {
+			for(uint8_t i=0;i<USB_NUM_INTERFACES;i++) {
+				if(!(notification & (1UL << i))) {
+					continue;
+				}
+				// process everything that is queued for this interface
+				char buffer[RX_CHUNK_SIZE];
+				size_t len;
+				while((len = xStreamBufferReceive(rxStream[i], buffer, sizeof(buffer), 0)) > 0) {
+					SCPI::Input(buffer, len, i);
+				}
+				if(rxStalled[i]) {
+					// there is space in the queue again, fetch the data left in the USB FIFO
+					rxStalled[i] = false;
+					usb_resume_receive(i);
+				}
+			}
+			if(notification & TRIGGER_NOTIFICATION) {
+				// advance the sequence in this task, all port changes happen here
+				uint32_t triggers = ulTaskNotifyTakeIndexed(TRIGGER_COUNT_INDEX, pdTRUE, 0);
+				while(triggers--) {
+					Sequence::Trigger();
+				}
+			}
+			// handle pending operations and service requests
+			SCPI::Poll();
+		}
 	}
-	memcpy(usb_buffer, buf, len);
-	usb_len = len;
-	usb_interface = i;
-	xTaskNotify(handle, 0x00, eNoAction);
 }
 
 bool createInfoFile() {
@@ -101,22 +172,30 @@ bool createInfoFile() {
 }
 
 static void defaultTask(void* ptr) {
-	handle = xTaskGetCurrentTaskHandle();
-
 	fr = f_mount(&fs0, "0:", 1);
 	if(fr != FR_OK) {
-		BYTE work[FF_MAX_SS];
-		f_mkfs("0:", 0, work, sizeof(work));
-		f_mount(&fs0, "0:", 1);
-		f_setlabel("0:LibreCAL_RW");
+		Scratch::Buffer<BYTE> work(FF_MAX_SS);
+		if(work) {
+			f_mkfs("0:", 0, work, FF_MAX_SS);
+			f_mount(&fs0, "0:", 1);
+			f_setlabel("0:LibreCAL_RW");
+		} else {
+			LOG_ERR("Unable to format drive 0");
+		}
 	}
 	fr = f_mount(&fs1, "1:", 1);
 	if(fr != FR_OK) {
-		BYTE work[FF_MAX_SS];
-		f_mkfs("1:", 0, work, sizeof(work));
-		f_mount(&fs1, "1:", 1);
-		f_setlabel("1:LibreCAL_R");
+		Scratch::Buffer<BYTE> work(FF_MAX_SS);
+		if(work) {
+			f_mkfs("1:", 0, work, FF_MAX_SS);
+			f_mount(&fs1, "1:", 1);
+			f_setlabel("1:LibreCAL_R");
+		} else {
+			LOG_ERR("Unable to format drive 1");
+		}
 	}
+	// Use the thermal model identified for this board (if available)
+	Heater::LoadParameters();
 	// Check info file
 	fr = f_open(&fil, "1:info.txt", FA_OPEN_EXISTING | FA_READ);
 	if (fr) {
@@ -144,26 +223,33 @@ static void defaultTask(void* ptr) {
 	// Figure out which mode we should be in. The default mode is the normal LibreCAL mode.
 	// You can always force that mode by pressing the function button when power is applied.
 	// If that button is not pressed, the LibreCAL may emulate other electronic calibration
-	// units it the necessary files are available
+	// units it the necessary files are available (or can be generated from the coefficients)
+	Siglent::Init();
 	if(UserInterface::IsFunctionHeld()) {
 		mode = MODE_DEFAULT;
 	} else {
 		// default mode is not forced, check files
-		if(!f_open(&fil, "0:siglent/info.dat", FA_OPEN_EXISTING | FA_READ)) {
+		if(Siglent::IsEnabled()) {
+			mode = MODE_SIGLENT;
+		} else if(!f_open(&fil, "0:siglent/info.dat", FA_OPEN_EXISTING | FA_READ)) {
 			// we have data in Siglent format
 			mode = MODE_SIGLENT;
 			f_close(&fil);
 		}
 	}
 
-	usb_init(usb_rx);
-
-	while(true) {
-		uint32_t notification;
-		if(xTaskNotifyWait(0, 0, &notification, portMAX_DELAY)) {
-			SCPI::Input(usb_buffer, usb_len, usb_interface);
-		}
+	for(uint8_t i=0;i<USB_NUM_INTERFACES;i++) {
+		rxStream[i] = xStreamBufferCreate(RX_STREAM_SIZE, 1);
+		rxStalled[i] = false;
 	}
+	// All commands are executed in the SCPI task. Large buffers (e.g. for deleting the factory
+	// coefficients) are taken from the scratch arena instead of the stack
+	xTaskCreate(scpiTask, "SCPI", 4096, NULL, 3, &scpiTaskHandle);
+
+	usb_init(usb_rx, usb_trigger);
+
+	// initialization done, this task is no longer needed
+	vTaskDelete(NULL);
 }
 
 static TaskHandle_t main_task;
@@ -207,11 +293,13 @@ int main(void) {
 
 	Switch::Init();
 	UserInterface::Init();
+	Status::Init(status_changed);
 	Heater::Init();
 	Heater::SetTarget(35);
-	SCPI::Init(usb_transmit);
+	SCPI::Init(usb_transmit, usb_transmit_end);
+	SCPI::SetQueryResponsesOnly(USB_INTERFACE_TMC);
 
-	xTaskCreate(defaultTask, "defaultTask", 16384, NULL, 3, &main_task);
+	xTaskCreate(defaultTask, "defaultTask", 1024, NULL, 3, &main_task);
 
 	vTaskStartScheduler();
 	return 0;
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+
+# Round-trips a large definite length block through the coefficient storage of
+# the LibreCAL and checks that the data is returned unchanged.
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import random
+import time
+
+SET_NAME = "BLOCK_TEST"
+COEFFICIENT = "P1_OPEN"
+BLOCK_SIZE = 100 * 1024
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+# writing to the flash takes a while
+cal.ser.timeout = 30
+
+# use every possible byte value, including line endings and '#'
+random.seed(0)
+data = bytes(random.getrandbits(8) for _ in range(BLOCK_SIZE))
+
+start = time.time()
+cal.setCoefficientData(SET_NAME, COEFFICIENT, data)
+print(f"Uploaded {len(data)} bytes in {time.time() - start:.2f}s")
+
+start = time.time()
+readback = cal.getCoefficientData(SET_NAME, COEFFICIENT)
+print(f"Downloaded {len(readback)} bytes in {time.time() - start:.2f}s")
+
+cal.SCPICommand(":COEFF:DEL "+SET_NAME+" "+COEFFICIENT)
+
+# the device must still be responsive after the block transfers
+cal.SCPICommand("*IDN?")
+
+if readback != data:
+    mismatch = next((i for i in range(min(len(data), len(readback))) if data[i] != readback[i]), min(len(data), len(readback)))
+    raise Exception(f"Readback mismatch at byte {mismatch} (sent {len(data)} bytes, received {len(readback)} bytes)")
+print("Block round trip successful")
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+
+# Sends 64KB of pipelined commands with a single write and checks that every
+# command is answered. The device has to throttle the host while its receive
+# queue is full instead of dropping data.
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import threading
+import time
+
+BURST_SIZE = 64 * 1024
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+cal.ser.timeout = 10
+
+standards = ["OPEN", "SHORT", "LOAD", "NONE"]
+commands = []
+expected = []
+size = 0
+i = 0
+while size < BURST_SIZE:
+    standard = standards[i % len(standards)]
+    for cmd, resp in [(":PORT 1 "+standard, ""), (":PORT? 1", standard)]:
+        commands.append(cmd)
+        expected.append(resp)
+        size += len(cmd) + 2
+    i += 1
+
+responses = []
+def reader():
+    while len(responses) < len(commands):
+        line = cal.ser.readline()
+        if len(line) == 0:
+            # timeout
+            return
+        responses.append(line.decode("ascii").strip())
+
+# Read in parallel, otherwise the device stops processing once the host no longer fetches responses
+thread = threading.Thread(target=reader)
+thread.start()
+start = time.time()
+cal.ser.write("".join(c+"\r\n" for c in commands).encode())
+thread.join()
+duration = time.time() - start
+
+cal.reset()
+
+if len(responses) != len(commands):
+    raise Exception(f"Only received {len(responses)} of {len(commands)} responses")
+for i in range(len(commands)):
+    if responses[i] != expected[i]:
+        raise Exception(f"Unexpected response to command {i} ('{commands[i]}'): '{responses[i]}', expected '{expected[i]}'")
+print(f"All {len(commands)} commands ({size} bytes) answered correctly in {duration:.2f}s ({size/duration/1024:.1f}KB/s)")
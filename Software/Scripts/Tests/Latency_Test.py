@@ -0,0 +1,27 @@
+#!/usr/bin/env python3
+
+# Measures the host-observed latency (time from sending a command until the
+# complete response has been received) for a few typical commands.
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import time
+
+REPETITIONS = 200
+COMMANDS = ["*IDN?", ":PORT? 1", ":COEFF:LIST?", ":TEMP?"]
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+
+for cmd in COMMANDS:
+    latencies = []
+    for i in range(REPETITIONS):
+        start = time.perf_counter()
+        cal.SCPICommand(cmd)
+        latencies.append(time.perf_counter() - start)
+    latencies.sort()
+    mean = sum(latencies) / len(latencies)
+    median = latencies[len(latencies) // 2]
+    print(f"{cmd:15s} mean {mean*1e3:6.3f}ms, median {median*1e3:6.3f}ms, min {latencies[0]*1e3:6.3f}ms, max {latencies[-1]*1e3:6.3f}ms")
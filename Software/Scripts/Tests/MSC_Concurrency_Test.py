@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+
+# Measures the coefficient download throughput (:COEFF:DATA?) and the command
+# latency (*IDN?) while the host reads from the mass storage drive at the same
+# time, compared to an idle drive. Both compete for the SPI flash.
+#
+# Usage (Linux, the host page cache is dropped for the file before each pass):
+#   python3 MSC_Concurrency_Test.py /media/<user>/LIBRECAL_R/P12_THROUGH.s2p
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import os
+import threading
+import time
+
+SET_NAME = "FACTORY"
+COEFFICIENT = "P12_THROUGH"
+REPETITIONS = 5
+LATENCY_REPETITIONS = 200
+
+if len(sys.argv) != 2:
+    print(f"usage: {sys.argv[0]} <file on the LibreCAL drive>")
+    sys.exit(1)
+msc_file = sys.argv[1]
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+cal.ser.timeout = 30
+
+msc_bytes = 0
+def msc_reader(stop):
+    global msc_bytes
+    while not stop.is_set():
+        fd = os.open(msc_file, os.O_RDONLY)
+        # force the next read to go to the device
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+        while not stop.is_set():
+            data = os.read(fd, 65536)
+            if len(data) == 0:
+                break
+            msc_bytes += len(data)
+        os.close(fd)
+
+def measure():
+    throughput = []
+    for i in range(REPETITIONS):
+        start = time.perf_counter()
+        data = cal.getCoefficientData(SET_NAME, COEFFICIENT)
+        throughput.append(len(data) / (time.perf_counter() - start) / 1024)
+    latencies = []
+    for i in range(LATENCY_REPETITIONS):
+        start = time.perf_counter()
+        cal.SCPICommand("*IDN?")
+        latencies.append(time.perf_counter() - start)
+    latencies.sort()
+    median = latencies[len(latencies) // 2]
+    p99 = latencies[len(latencies) * 99 // 100]
+    print(f"  download {sum(throughput) / len(throughput):7.1f}KB/s, *IDN? median {median*1e3:6.3f}ms, 99% {p99*1e3:6.3f}ms, max {latencies[-1]*1e3:6.3f}ms")
+
+print("Idle drive:")
+measure()
+
+print("Concurrent drive reads:")
+stop = threading.Event()
+reader = threading.Thread(target=msc_reader, args=(stop,))
+start = time.perf_counter()
+reader.start()
+measure()
+stop.set()
+reader.join()
+print(f"  drive read {msc_bytes / (time.perf_counter() - start) / 1024:7.1f}KB/s")
@@ -0,0 +1,28 @@
+#!/usr/bin/env python3
+
+# Prints the RAM usage reported by :SYST:MEM? after exercising the commands
+# with the largest stack usage, to check the headroom of the task stacks.
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+
+SET_NAME = "MEMORY_TEST"
+COEFFICIENT = "P12_THROUGH"
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+cal.ser.timeout = 30
+
+# write, read and interpolate a coefficient
+lines = ["# GHz S RI R 50.0"]
+for i in range(101):
+    lines.append(f"{0.001 + i * 0.06:f}" + " 0.012345 -0.023456" * 4)
+cal.setCoefficientData(SET_NAME, COEFFICIENT, ("\r\n".join(lines) + "\r\n").encode())
+cal.getCoefficientData(SET_NAME, COEFFICIENT)
+cal.SCPICommand(":COEFF:GET? "+SET_NAME+" "+COEFFICIENT+" 0")
+cal.SCPICommand(":COEFF:DEL "+SET_NAME+" "+COEFFICIENT)
+
+for name, values in cal.getMemoryUsage().items():
+    print(f"{name:25s} " + ", ".join(str(v) for v in values))
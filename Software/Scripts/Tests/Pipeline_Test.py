@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+
+# Sends a large number of commands to the LibreCAL without waiting for the
+# responses in between and checks that every single command is answered.
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import threading
+import time
+
+NUM_COMMANDS = 10000
+# commands are sent in bursts of this many commands per write
+BURST = 100
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+cal.ser.timeout = 10
+
+standards = ["OPEN", "SHORT", "LOAD", "NONE"]
+commands = []
+expected = []
+for i in range(NUM_COMMANDS // 2):
+    standard = standards[i % len(standards)]
+    commands.append(":PORT 1 "+standard)
+    expected.append("")
+    commands.append(":PORT? 1")
+    expected.append(standard)
+
+responses = []
+def reader():
+    while len(responses) < len(commands):
+        line = cal.ser.readline()
+        if len(line) == 0:
+            # timeout
+            return
+        responses.append(line.decode("ascii").strip())
+
+# Read in parallel, otherwise the device stops processing once the host no longer fetches responses
+thread = threading.Thread(target=reader)
+thread.start()
+start = time.time()
+for i in range(0, len(commands), BURST):
+    cal.ser.write("".join(c+"\r\n" for c in commands[i:i+BURST]).encode())
+thread.join()
+duration = time.time() - start
+
+cal.reset()
+
+if len(responses) != len(commands):
+    raise Exception(f"Only received {len(responses)} of {len(commands)} responses")
+for i in range(len(commands)):
+    if responses[i] != expected[i]:
+        raise Exception(f"Unexpected response to command {i} ('{commands[i]}'): '{responses[i]}', expected '{expected[i]}'")
+print(f"All {len(commands)} pipelined commands answered correctly in {duration:.2f}s ({len(commands)/duration:.0f} commands/s)")
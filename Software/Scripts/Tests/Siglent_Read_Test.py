@@ -0,0 +1,31 @@
+#!/usr/bin/env python3
+
+# Measures how long it takes to pull data0.zip through the Siglent USBTMC
+# interface, emulating the FL:DATA: commands a Siglent VNA sends. The LibreCAL
+# must be in Siglent mode (siglent/info.dat present on the storage).
+
+import pyvisa
+import time
+
+REQUEST_SIZES = [1024, 4096, 16384, 65536]
+
+rm = pyvisa.ResourceManager('@py')
+resources = [r for r in rm.list_resources() if "0xF4EC::0x1600" in r.upper()]
+if len(resources) == 0:
+    raise Exception("No LibreCAL in Siglent mode detected")
+tmc = rm.open_resource(resources[0])
+tmc.timeout = 5000
+print("Connected to "+tmc.query("*IDN?").strip())
+
+for size in REQUEST_SIZES:
+    tmc.write("FL:DATA:INDEX 0")
+    received = 0
+    start = time.perf_counter()
+    while True:
+        tmc.write("FL:DATA:READ? "+str(size))
+        data = tmc.read_raw(size)
+        received += len(data)
+        if len(data) < size:
+            break
+    duration = time.perf_counter() - start
+    print(f"{size:6d} byte requests: {received} bytes in {duration:.3f}s, {received / duration / 1024:.1f}KB/s")
@@ -0,0 +1,37 @@
+#!/usr/bin/env python3
+
+# Prints the processor usage of the tasks reported by :SYST:TASK?, once for an
+# idle LibreCAL and once while coefficients are downloaded. The usage of each
+# phase is calculated from the difference of the run times of two queries.
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import time
+
+SET_NAME = "FACTORY"
+COEFFICIENT = "P12_THROUGH"
+IDLE_TIME = 5
+REPETITIONS = 5
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+cal.ser.timeout = 30
+
+def usage(before, after):
+    total = sum(after[name][3] - before.get(name, after[name])[3] for name in after)
+    for name, (state, priority, share, runtime) in after.items():
+        delta = runtime - before.get(name, after[name])[3]
+        print(f"  {name:16s} priority {priority}, {100 * delta / total:5.1f}% ({share:5.1f}% since power-up)")
+
+print("Idle:")
+before = cal.getTasks()
+time.sleep(IDLE_TIME)
+usage(before, cal.getTasks())
+
+print("Coefficient download:")
+before = cal.getTasks()
+for i in range(REPETITIONS):
+    cal.getCoefficientData(SET_NAME, COEFFICIENT)
+usage(before, cal.getTasks())
@@ -0,0 +1,42 @@
+#!/usr/bin/env python3
+
+# Measures the streaming throughput of a complete coefficient download
+# (:COEFF:GET? without a point index, which streams the stored file).
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import time
+
+SET_NAME = "THROUGHPUT_TEST"
+COEFFICIENT = "P12_THROUGH"
+POINTS = 2001
+REPETITIONS = 5
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+cal.ser.timeout = 30
+
+# create a two port coefficient with typical values
+lines = ["# GHz S RI R 50.0"]
+for i in range(POINTS):
+    freq = 0.001 + i * 6.0 / (POINTS - 1)
+    lines.append(f"{freq:f}" + " 0.012345 -0.023456" * 4)
+cal.setCoefficientData(SET_NAME, COEFFICIENT, ("\r\n".join(lines) + "\r\n").encode())
+
+for i in range(REPETITIONS):
+    received = 0
+    start = time.perf_counter()
+    cal.ser.write((":COEFF:GET? "+SET_NAME+" "+COEFFICIENT+"\r\n").encode())
+    while True:
+        line = cal.ser.readline()
+        if len(line) == 0:
+            raise Exception("Timeout occurred in communication with LibreCAL")
+        received += len(line)
+        if line.strip() == b"END":
+            break
+    duration = time.perf_counter() - start
+    print(f"Received {received} bytes in {duration:.3f}s: {received / duration / 1024:.1f}KB/s")
+
+cal.SCPICommand(":COEFF:DEL "+SET_NAME+" "+COEFFICIENT)
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+
+# Sends trigger control requests back to back while the LibreCAL is busy
+# streaming a large coefficient and checks that the sequence advanced by
+# exactly one step per trigger.
+
+import sys
+sys.path.append('..')
+from libreCAL import libreCAL
+import usb.core
+
+SET_NAME = "TRIGGER_TEST"
+COEFFICIENT = "P1_OPEN"
+BLOCK_SIZE = 100 * 1024
+SEQUENCE = ["ONNN", "SNNN", "LNNN", "NONN", "NSNN", "NLNN", "NNON", "NNSN", "NNLN", "NNNO"]
+TRIGGERS = 7
+VENDOR_REQUEST_TRIGGER = 2
+
+# Connect to the first detected LibreCAL
+cal = libreCAL()
+print("Connected to LibreCAL with serial "+cal.getSerial())
+cal.ser.timeout = 30
+
+dev = usb.core.find(idVendor=0x1209, idProduct=0x4122)
+if dev is None:
+    dev = usb.core.find(idVendor=0x0483, idProduct=0x4122)
+if dev is None:
+    raise Exception("LibreCAL not found for control requests")
+
+def trigger():
+    # vendor request to the device, host to device, no data stage
+    dev.ctrl_transfer(0x40, VENDOR_REQUEST_TRIGGER, 0, 0, None)
+
+data = bytes(i % 251 for i in range(BLOCK_SIZE))
+cal.setCoefficientData(SET_NAME, COEFFICIENT, data)
+
+cal.defineSequence("TRIGTEST", SEQUENCE)
+cal.startSequence("TRIGTEST")
+
+# start the transfer but only read the block header, the SCPI task stays busy
+# sending the block while the triggers arrive
+cal.ser.write((":COEFF:DATA? "+SET_NAME+" "+COEFFICIENT+"\r\n").encode())
+start = cal.ser.read(2)
+if start[0:1] != b"#":
+    raise Exception("LibreCAL did not return a block")
+length = int(cal.ser.read(int(start[1:2])))
+for i in range(TRIGGERS):
+    trigger()
+readback = cal.ser.read(length)
+cal.ser.readline()
+if readback != data:
+    raise Exception("Coefficient changed during the triggers")
+
+step = int(cal.SCPICommand(":SEQ:STEP?").split(" ")[0])
+cal.SCPICommand(":SEQ:DEL TRIGTEST")
+cal.SCPICommand(":COEFF:DEL "+SET_NAME+" "+COEFFICIENT)
+cal.reset()
+
+if step != 1 + TRIGGERS:
+    raise Exception(f"Sequence at step {step} after {TRIGGERS} triggers, expected step {1 + TRIGGERS}")
+print(f"All {TRIGGERS} triggers advanced the sequence")
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+
+# Checks the SCPI command set over USBTMC: identification, port control, the
+# pairing of responses with queries and a coefficient transfer larger than a
+# single USB packet.
+
+import pyvisa
+
+SET_NAME = "USBTMC_TEST"
+COEFFICIENT = "P1_OPEN"
+POINTS = 201
+
+rm = pyvisa.ResourceManager('@py')
+resources = [r for r in rm.list_resources() if "0x1209::0x4122" in r or "0x0483::0x4122" in r]
+if len(resources) == 0:
+    raise Exception("No LibreCAL with USBTMC interface detected")
+tmc = rm.open_resource(resources[0])
+tmc.timeout = 5000
+tmc.read_termination = "\r\n"
+print("Connected to "+tmc.query("*IDN?"))
+
+def query(cmd):
+    resp = tmc.query(cmd)
+    if resp == "ERROR":
+        raise Exception("LibreCAL returned 'ERROR' for query '"+cmd+"'")
+    return resp
+
+def command(cmd):
+    # events have no response, failures are reported in the standard event status register
+    tmc.write(cmd)
+    if int(tmc.query("*ESR?")) & 0x30:
+        raise Exception("Command '"+cmd+"' failed")
+
+tmc.query("*ESR?")
+
+# every read must return the response of the preceding query
+tmc.write(":PORT 1 OPEN")
+if query(":PORT? 1") != "OPEN":
+    raise Exception("Port 1 not set to OPEN or responses out of order")
+tmc.write(":PORT 1 SHORT")
+tmc.write(":PORT 1 LOAD")
+if query(":PORT? 1") != "LOAD":
+    raise Exception("Port 1 not set to LOAD or responses out of order")
+command(":PORT 1 NONE")
+
+# a failing event has no response either
+tmc.write(":PORT 9 OPEN")
+if not int(query("*ESR?")) & 0x10:
+    raise Exception("Failed command did not set the execution error bit")
+if query("*IDN?").split(",")[0] != "LibreCAL":
+    raise Exception("Responses out of order after a failed command")
+
+lines = ["# GHz S RI R 50.0"]
+for i in range(POINTS):
+    lines.append(f"{0.001 + i * 6.0 / (POINTS - 1):f} 0.987654 -0.012345")
+data = ("\r\n".join(lines) + "\r\n").encode()
+length = str(len(data))
+tmc.write_raw((":COEFF:DATA "+SET_NAME+" "+COEFFICIENT+" #"+str(len(length))+length).encode() + data)
+if int(query("*ESR?")) & 0x30:
+    raise Exception("Failed to store coefficient")
+
+tmc.write(":COEFF:DATA? "+SET_NAME+" "+COEFFICIENT)
+resp = tmc.read_raw()
+digits = int(resp[1:2])
+received = resp[2+digits:2+digits+int(resp[2:2+digits])]
+command(":COEFF:DEL "+SET_NAME+" "+COEFFICIENT)
+if received != data:
+    raise Exception("Coefficient data mismatch")
+print(f"Transferred {len(data)} bytes in both directions")
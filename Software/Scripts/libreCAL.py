@@ -61,6 +61,18 @@ class libreCAL:
         except:
             raise Exception("LibreCAL reported unknown standard '"+resp+"'")
             
+    def waitSettled(self):
+        self.SCPICommand(":PORT:WAIT?")
+
+    def defineSequence(self, name, steps):
+        self.SCPICommand(":SEQ:DEF "+name+" "+" ".join(steps))
+
+    def startSequence(self, name):
+        self.SCPICommand(":SEQ:STAR "+name)
+
+    def triggerSequence(self):
+        self.SCPICommand("*TRG")
+
     def getTemperature(self):
         return float(self.SCPICommand(":TEMP?"))
     
@@ -70,6 +82,51 @@ class libreCAL:
         else:
             return False
         
+    def waitStable(self, timeout = 600):
+        # *OPC? only returns once the temperature is stable
+        self.ser.timeout = timeout
+        try:
+            self.SCPICommand("*OPC?")
+        finally:
+            self.ser.timeout = 1
+
+    def getTimeToStable(self):
+        # predicted time in seconds, -1 if unknown
+        return int(self.SCPICommand(":TEMP:ETA?"))
+
+    def getTemperatureHistory(self, since = 0):
+        # returns a list of (time, temperature, power, stable) tuples recorded after since
+        self.ser.write((":TEMP:HIST? "+str(since)+"\r\n").encode())
+        cnt = int(self.ser.readline().decode("ascii").strip())
+        samples = []
+        for i in range(cnt):
+            values = self.ser.readline().decode("ascii").strip().split(",")
+            samples.append((float(values[0]), float(values[1]), float(values[2]), values[3] == "TRUE"))
+        return samples
+
+    def getMemoryUsage(self):
+        # returns a dictionary of entry name (e.g. "HEAP" or "TASK,SCPI") to list of sizes in bytes
+        self.ser.write(":SYST:MEM?\r\n".encode())
+        cnt = int(self.ser.readline().decode("ascii").strip())
+        usage = {}
+        for i in range(cnt):
+            values = self.ser.readline().decode("ascii").strip().split(",")
+            if values[0] == "TASK":
+                usage["TASK,"+values[1]] = [int(v) for v in values[2:]]
+            else:
+                usage[values[0]] = [int(v) for v in values[1:]]
+        return usage
+
+    def getTasks(self):
+        # returns a dictionary of task name to (state, priority, share in percent, run time in microseconds)
+        self.ser.write(":SYST:TASK?\r\n".encode())
+        cnt = int(self.ser.readline().decode("ascii").strip())
+        tasks = {}
+        for i in range(cnt):
+            values = self.ser.readline().decode("ascii").strip().split(",")
+            tasks[values[0]] = (values[1], int(values[2]), float(values[3]), int(values[4]))
+        return tasks
+
     def getHeaterPower(self):
         return float(self.SCPICommand(":HEAT:POW?"))
 
@@ -106,6 +163,44 @@ class libreCAL:
         dt_str_with_offset = f"{dt_str} UTC{offset_str}"
         self.setDateTimeUTC(dr_str_with_offset)
 
+    def setSiglentSource(self, setname):
+        # coefficient set the Siglent eCal data is generated from, None to disable
+        self.SCPICommand(":SIGL:SOUR "+(setname if setname else "NONE"))
+
+    def getSiglentSource(self):
+        resp = self.SCPICommand(":SIGL:SOUR?")
+        return None if resp == "NONE" else resp
+
+    def setCoefficientData(self, setname, coefficient, data : bytes):
+        length = str(len(data))
+        header = ":COEFF:DATA "+setname+" "+coefficient+" #"+str(len(length))+length
+        self.ser.write(header.encode() + data + b"\r\n")
+        resp = self.ser.readline().decode("ascii")
+        if len(resp) == 0:
+            raise Exception("Timeout occurred in communication with LibreCAL")
+        if resp.strip() == "ERROR":
+            raise Exception("LibreCAL failed to store coefficient '"+coefficient+"' in set '"+setname+"'")
+
+    def setCoefficientTemperature(self, setname, temperature):
+        self.SCPICommand(":COEFF:TEMP "+setname+" "+str(temperature))
+
+    def getCoefficientTemperature(self, setname):
+        return float(self.SCPICommand(":COEFF:TEMP? "+setname))
+
+    def getCoefficientData(self, setname, coefficient) -> bytes:
+        self.ser.write((":COEFF:DATA? "+setname+" "+coefficient+"\r\n").encode())
+        start = self.ser.read(2)
+        if len(start) < 2 or start[0:1] != b"#":
+            rest = self.ser.readline()
+            raise Exception("LibreCAL returned '"+(start+rest).decode("ascii").strip()+"' instead of a block")
+        length = int(self.ser.read(int(start[1:2])))
+        data = self.ser.read(length)
+        if len(data) != length:
+            raise Exception("Timeout occurred in communication with LibreCAL")
+        # consume line termination
+        self.ser.readline()
+        return data
+
     def SCPICommand(self, cmd: str) -> str:
         self.ser.write((cmd+"\r\n").encode())
         resp = self.ser.readline().decode("ascii")